@@ -54,9 +54,13 @@ namespace romiserial {
                         return (n == 1)? true : false;
                 }
 
-                bool write(char c) {
+                bool write(char c) override {
                         return stream_.write(c) == 1;
                 }
+
+                bool write(const char *data, size_t length) override {
+                        return stream_.write((const uint8_t *) data, length) == length;
+                }
         };
 }
 
@@ -0,0 +1,62 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef __ROMISERIAL_CANCELLATIONTOKEN_H
+#define __ROMISERIAL_CANCELLATIONTOKEN_H
+
+#include <atomic>
+
+namespace romiserial {
+
+        /**
+         *  A flag that can be set from any thread to cancel the
+         *  requests that refer to it. One token can be shared by
+         *  several requests. The token must outlive these requests.
+         */
+        class CancellationToken
+        {
+        protected:
+                std::atomic<bool> cancelled_;
+
+        public:
+                CancellationToken() : cancelled_(false) {}
+                CancellationToken(const CancellationToken&) = delete;
+                CancellationToken& operator=(const CancellationToken&) = delete;
+                ~CancellationToken() = default;
+
+                void cancel() {
+                        cancelled_.store(true, std::memory_order_release);
+                }
+
+                void reset() {
+                        cancelled_.store(false, std::memory_order_release);
+                }
+
+                bool is_cancelled() const {
+                        return cancelled_.load(std::memory_order_acquire);
+                }
+        };
+}
+
+#endif // __ROMISERIAL_CANCELLATIONTOKEN_H
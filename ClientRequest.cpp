@@ -0,0 +1,168 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include "ClientRequest.h"
+#include "RomiSerialErrors.h"
+#include "rtime.h"
+
+namespace romiserial {
+
+        // The interval at which wait_until() checks the request.
+        // There is no timed wait on an atomic.
+        static const double kWaitUntilPoll = 0.0005;
+
+        ClientRequest::ClientRequest()
+                : MPSCNode(),
+                  encoder_(),
+                  error_(0),
+                  response_(),
+                  priority_(kNormalPriority),
+                  submit_time_(0.0),
+                  start_time_(0.0),
+                  deadline_(0.0),
+                  token_(nullptr),
+                  coalesced_(false),
+                  followers_(nullptr),
+                  next_follower_(nullptr),
+                  next_in_flight_(nullptr),
+                  next_queued_(nullptr),
+                  batch_size_(0),
+                  on_complete_(nullptr),
+                  on_complete_context_(nullptr),
+                  state_(kIdle)
+        {
+        }
+
+        ClientRequest::ClientRequest(const char *command)
+                : ClientRequest()
+        {
+                set_command(command);
+        }
+
+        int ClientRequest::set_command(const char *command)
+        {
+                ROMISERIAL_TRACE_SCOPE("encode", "client");
+                error_ = encoder_.encode(command);
+                return error_;
+        }
+
+        int ClientRequest::set_command(const CommandTemplate& command,
+                                       const int16_t *args, size_t count)
+        {
+                ROMISERIAL_TRACE_SCOPE("encode", "client");
+                error_ = command.encode(encoder_, args, count);
+                return error_;
+        }
+
+        int ClientRequest::set_command(const CommandTemplate& command,
+                                       const char *suffix)
+        {
+                ROMISERIAL_TRACE_SCOPE("encode", "client");
+                error_ = command.encode(encoder_, suffix);
+                return error_;
+        }
+
+        bool ClientRequest::has_same_command(const ClientRequest& other) const
+        {
+                return (error_ == 0
+                        && other.error_ == 0
+                        && encoder_.message_length() == other.encoder_.message_length()
+                        && memcmp(encoder_.message(), other.encoder_.message(),
+                                  encoder_.message_length()) == 0);
+        }
+
+        bool ClientRequest::is_pending() const
+        {
+                return state_.load(std::memory_order_acquire) == kPending;
+        }
+
+        bool ClientRequest::is_complete() const
+        {
+                return state_.load(std::memory_order_acquire) == kComplete;
+        }
+
+        void ClientRequest::wait()
+        {
+                uint32_t state = state_.load(std::memory_order_acquire);
+                while (state == kPending) {
+                        state_.wait(state, std::memory_order_acquire);
+                        state = state_.load(std::memory_order_acquire);
+                }
+        }
+
+        int ClientRequest::wait_until(double deadline)
+        {
+                while (is_pending()) {
+                        double remaining = deadline - rtime();
+                        if (remaining <= 0.0)
+                                return is_cancelled()? kRequestCancelled : kDeadlineExceeded;
+                        rsleep(std::min(remaining, kWaitUntilPoll));
+                }
+                return response_.status();
+        }
+
+        void ClientRequest::set_pending(double now)
+        {
+                submit_time_ = now;
+                start_time_ = 0.0;
+                coalesced_ = false;
+                followers_ = nullptr;
+                next_follower_ = nullptr;
+                next_in_flight_ = nullptr;
+                next_queued_ = nullptr;
+                batch_size_ = 0;
+                state_.store(kPending, std::memory_order_release);
+        }
+
+        void ClientRequest::set_started(double now)
+        {
+                start_time_ = now;
+        }
+
+        void ClientRequest::complete()
+        {
+                // Read before the request is handed back to its
+                // owner.
+                CompletionCallback callback = on_complete_;
+                void *context = on_complete_context_;
+
+                state_.store(kComplete, std::memory_order_release);
+
+                // The owner may release the request as soon as it
+                // sees kComplete. notify_all() only hands the address
+                // of state_ to the kernel to wake the waiters. It
+                // does not read or write the request.
+                state_.notify_all();
+
+                if (callback != nullptr)
+                        callback(context);
+        }
+}
+
+#endif
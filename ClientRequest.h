@@ -0,0 +1,312 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef __ROMISERIAL_CLIENTREQUEST_H
+#define __ROMISERIAL_CLIENTREQUEST_H
+
+#if !defined(ARDUINO)
+
+#include <atomic>
+#include <string_view>
+#include <MPSCQueue.h>
+#include <CancellationToken.h>
+#include <EnvelopeEncoder.h>
+#include <CommandTemplate.h>
+#include <TypedCommand.h>
+#include <Response.h>
+#include <Tracer.h>
+
+namespace romiserial {
+
+        /* High-priority requests are sent before any queued normal
+         * request. A request that is already on the link is not
+         * interrupted. */
+        enum RequestPriority {
+                kNormalPriority = 0,
+                kHighPriority = 1,
+                kNumberOfPriorities = 2
+        };
+
+        /* Called when a request completes. See
+         * ClientRequest::set_completion_callback(). */
+        typedef void (*CompletionCallback)(void *context);
+
+        /**
+         *  A request that is submitted to a RomiSerialClient and
+         *  serves as its completion handle. The client does not copy
+         *  or allocate requests: the caller owns the object and must
+         *  keep it alive until is_complete() returns true, or until
+         *  wait() returns. The client does not touch the request
+         *  after it marked it complete.
+         *
+         *  The command is encoded in set_command(), in the caller's
+         *  thread, into a fixed buffer. The I/O thread only adds the
+         *  ID and the CRC.
+         */
+        class ClientRequest : public MPSCNode
+        {
+        public:
+                enum {
+                        kIdle = 0,
+                        kPending = 1,
+                        kComplete = 2
+                };
+
+        protected:
+                EnvelopeEncoder encoder_;
+                int error_;
+                Response response_;
+                RequestPriority priority_;
+                double submit_time_;
+                double start_time_;
+                double deadline_;
+                const CancellationToken *token_;
+
+                // Identical read-only requests share one round
+                // trip. The followers are chained to the request that
+                // goes on the link. See RomiSerialClient::set_read_only().
+                bool coalesced_;
+                ClientRequest *followers_;
+                ClientRequest *next_follower_;
+                ClientRequest *next_in_flight_;
+                // The queue of requests that the I/O thread took out
+                // of the lane queue to check their deadlines.
+                ClientRequest *next_queued_;
+
+                // The number of requests, stored contiguously from
+                // this one, that are sent as one batch. Zero for a
+                // request that is not part of a batch.
+                size_t batch_size_;
+
+                CompletionCallback on_complete_;
+                void *on_complete_context_;
+
+                std::atomic<uint32_t> state_;
+
+        public:
+                ClientRequest();
+                explicit ClientRequest(const char *command);
+                ClientRequest(const ClientRequest&) = delete;
+                ClientRequest& operator=(const ClientRequest&) = delete;
+                ~ClientRequest() = default;
+
+                /** Sets and encodes the command. Only valid when the
+                 * request is not pending. Returns zero or the error
+                 * code if the command is invalid. In the latter case
+                 * the request will complete with that error. */
+                int set_command(const char *command);
+
+                /** Sets the command using a pre-encoded template. See
+                 * CommandTemplate::encode(). */
+                int set_command(const CommandTemplate& command,
+                                const int16_t *args, size_t count);
+                int set_command(const CommandTemplate& command,
+                                const char *suffix);
+
+                /** Sets a typed command, checked at compile time. See
+                 * TypedCommand. Returns zero or kInvalidString if a
+                 * string argument has a character that the firmware
+                 * rejects. */
+                template <char Opcode, typename... Args>
+                int set_command(const Args&... args) {
+                        ROMISERIAL_TRACE_SCOPE("encode", "client");
+                        error_ = TypedCommand<Opcode, Args...>::encode(encoder_, args...);
+                        return error_;
+                }
+
+                int error() const {
+                        return error_;
+                }
+
+                EnvelopeEncoder& encoder() {
+                        return encoder_;
+                }
+
+                const EnvelopeEncoder& encoder() const {
+                        return encoder_;
+                }
+
+                /** The response of the firmware. Only valid once the
+                 * request has completed. */
+                Response& response() {
+                        return response_;
+                }
+
+                /** Sets the absolute time, in the clock of rtime(),
+                 * before which the response is needed. A request
+                 * whose deadline has passed is not sent, and the
+                 * client stops waiting for its response at the
+                 * deadline. The request then fails with
+                 * kDeadlineExceeded. A value of zero removes the
+                 * deadline. */
+                void set_deadline(double deadline) {
+                        deadline_ = deadline;
+                }
+
+                double deadline() const {
+                        return deadline_;
+                }
+
+                bool has_deadline() const {
+                        return deadline_ > 0.0;
+                }
+
+                bool has_expired(double now) const {
+                        return has_deadline() && now >= deadline_;
+                }
+
+                /** A cancelled request is not sent. If it is already
+                 * on the link, the client stops waiting for its
+                 * response. The request fails with kRequestCancelled
+                 * and its late response is discarded. */
+                void set_cancellation_token(const CancellationToken *token) {
+                        token_ = token;
+                }
+
+                bool is_cancellable() const {
+                        return token_ != nullptr;
+                }
+
+                bool is_cancelled() const {
+                        return token_ != nullptr && token_->is_cancelled();
+                }
+
+                /** Registers a function that is called when the
+                 * request completes, by the thread that completes it:
+                 * usually the I/O thread of the client, or the
+                 * caller's thread when submit() completes the request
+                 * right away. The function is called after the request
+                 * was marked complete. The owner may already have
+                 * reused or released the request at that point, so
+                 * the function should not touch the request, only
+                 * signal its owner. The context must remain valid
+                 * until the function returns. */
+                void set_completion_callback(CompletionCallback callback,
+                                             void *context) {
+                        on_complete_ = callback;
+                        on_complete_context_ = context;
+                }
+
+                void set_priority(RequestPriority priority) {
+                        priority_ = priority;
+                }
+
+                RequestPriority priority() const {
+                        return priority_;
+                }
+
+                /** The time the request was submitted and the time
+                 * the I/O thread started handling it. */
+                double submit_time() const {
+                        return submit_time_;
+                }
+
+                double start_time() const {
+                        return start_time_;
+                }
+
+                bool is_pending() const;
+                bool is_complete() const;
+
+                /** Blocks the calling thread until the I/O thread of
+                 * the client has completed the request. */
+                void wait();
+
+                /** Blocks the calling thread until the request has
+                 * completed or until the deadline, in the clock of
+                 * rtime(). Returns the status of the response, or
+                 * kRequestCancelled or kDeadlineExceeded if the
+                 * request is not complete yet. In that case the
+                 * request still belongs to the client until
+                 * is_complete() returns true. The client drops
+                 * queued requests that are cancelled or past their
+                 * deadline within kRomiSerialClientCancelPoll, so a
+                 * request with the same deadline completes shortly
+                 * after. */
+                int wait_until(double deadline);
+
+                /** The encoded command, without the envelope. */
+                std::string_view command() const {
+                        return std::string_view(encoder_.message(),
+                                                encoder_.message_length());
+                }
+
+                /** Returns true if both requests encode the same
+                 * command. The ID and CRC are not compared. */
+                bool has_same_command(const ClientRequest& other) const;
+
+                /* Called by RomiSerialClient. */
+                void set_pending(double now);
+                void set_started(double now);
+                void complete();
+
+                void set_batch_size(size_t size) {
+                        batch_size_ = size;
+                }
+
+                size_t batch_size() const {
+                        return batch_size_;
+                }
+
+                void set_coalesced(bool value) {
+                        coalesced_ = value;
+                }
+
+                bool is_coalesced() const {
+                        return coalesced_;
+                }
+
+                void add_follower(ClientRequest *request) {
+                        request->next_follower_ = followers_;
+                        followers_ = request;
+                }
+
+                ClientRequest *followers() const {
+                        return followers_;
+                }
+
+                ClientRequest *next_follower() const {
+                        return next_follower_;
+                }
+
+                ClientRequest *next_in_flight() const {
+                        return next_in_flight_;
+                }
+
+                void set_next_in_flight(ClientRequest *request) {
+                        next_in_flight_ = request;
+                }
+
+                ClientRequest *next_queued() const {
+                        return next_queued_;
+                }
+
+                void set_next_queued(ClientRequest *request) {
+                        next_queued_ = request;
+                }
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_CLIENTREQUEST_H
@@ -0,0 +1,199 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#if !defined(ARDUINO)
+
+#include <math.h>
+#include <algorithm>
+#include "ClockEstimator.h"
+
+namespace romiserial {
+
+        ClockEstimator::ClockEstimator(size_t window)
+                : mutex_(),
+                  samples_(std::max(window, (size_t) 1)),
+                  next_(0),
+                  count_(0),
+                  interval_start_(0.0),
+                  epoch_(0),
+                  last_micros_(0),
+                  reference_(0.0),
+                  offset_(0.0),
+                  drift_(0.0),
+                  error_(0.0),
+                  has_delays_(false),
+                  request_delay_(0.0),
+                  response_delay_(0.0)
+        {
+        }
+
+        void ClockEstimator::reset()
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                next_ = 0;
+                count_ = 0;
+                offset_ = 0.0;
+                drift_ = 0.0;
+                error_ = 0.0;
+                has_delays_ = false;
+                request_delay_ = 0.0;
+                response_delay_ = 0.0;
+        }
+
+        // The timestamp closest to the last one.
+        int64_t ClockEstimator::unwrap(uint32_t micros) const
+        {
+                return last_micros_ + (int32_t) (micros - (uint32_t) last_micros_);
+        }
+
+        double ClockEstimator::firmware_seconds(uint32_t micros) const
+        {
+                return (double) (unwrap(micros) - epoch_) * 1.0e-6;
+        }
+
+        double ClockEstimator::host_time(double firmware) const
+        {
+                // Solves firmware - host = offset + drift * (host - reference).
+                return reference_ + (firmware - reference_ - offset_) / (1.0 + drift_);
+        }
+
+        void ClockEstimator::add_sample(double sent, double received, uint32_t micros)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                
+                if (count_ == 0) {
+                        epoch_ = micros;
+                        last_micros_ = micros;
+                } else {
+                        last_micros_ = unwrap(micros);
+                }
+
+                Sample sample;
+                sample.host = 0.5 * (sent + received);
+                sample.firmware = (double) (last_micros_ - epoch_) * 1.0e-6;
+                sample.uncertainty = std::max(0.5 * (received - sent),
+                                              kMinimumUncertainty);
+
+                size_t size = samples_.size();
+                if (count_ == 0 || sample.host - interval_start_ >= kSampleInterval) {
+                        samples_[next_] = sample;
+                        next_ = (next_ + 1) % size;
+                        if (count_ < size)
+                                count_++;
+                        interval_start_ = sample.host;
+                } else {
+                        Sample& current = samples_[(next_ + size - 1) % size];
+                        if (sample.uncertainty <= current.uncertainty)
+                                current = sample;
+                }
+                
+                fit();
+
+                double time = host_time(sample.firmware);
+                double request_delay = time - sent;
+                double response_delay = received - time;
+                if (!has_delays_) {
+                        request_delay_ = request_delay;
+                        response_delay_ = response_delay;
+                        has_delays_ = true;
+                } else {
+                        request_delay_ += kAlpha * (request_delay - request_delay_);
+                        response_delay_ += kAlpha * (response_delay - response_delay_);
+                }
+        }
+
+        void ClockEstimator::fit()
+        {
+                size_t size = samples_.size();
+                size_t first = (next_ + size - count_) % size;
+                
+                reference_ = samples_[(next_ + size - 1) % size].host;
+
+                double sum_w = 0.0;
+                double sum_x = 0.0;
+                double sum_y = 0.0;
+                for (size_t i = 0; i < count_; i++) {
+                        const Sample& s = samples_[(first + i) % size];
+                        double w = 1.0 / (s.uncertainty * s.uncertainty);
+                        sum_w += w;
+                        sum_x += w * (s.host - reference_);
+                        sum_y += w * (s.firmware - s.host);
+                }
+                double mean_x = sum_x / sum_w;
+                double mean_y = sum_y / sum_w;
+
+                double sum_xx = 0.0;
+                double sum_xy = 0.0;
+                for (size_t i = 0; i < count_; i++) {
+                        const Sample& s = samples_[(first + i) % size];
+                        double w = 1.0 / (s.uncertainty * s.uncertainty);
+                        double dx = s.host - reference_ - mean_x;
+                        double dy = s.firmware - s.host - mean_y;
+                        sum_xx += w * dx * dx;
+                        sum_xy += w * dx * dy;
+                }
+
+                // One sample, or samples taken at the same time,
+                // say nothing about the drift.
+                drift_ = (sum_xx > 0.0)? sum_xy / sum_xx : 0.0;
+                offset_ = mean_y - drift_ * mean_x;
+
+                double sum_rr = 0.0;
+                double uncertainty = INFINITY;
+                for (size_t i = 0; i < count_; i++) {
+                        const Sample& s = samples_[(first + i) % size];
+                        double w = 1.0 / (s.uncertainty * s.uncertainty);
+                        double x = s.host - reference_;
+                        double residual = s.firmware - s.host - (offset_ + drift_ * x);
+                        sum_rr += w * residual * residual;
+                        uncertainty = std::min(uncertainty, s.uncertainty);
+                }
+                error_ = sqrt(sum_rr / sum_w) + uncertainty;
+        }
+
+        bool ClockEstimator::to_host_time(uint32_t micros, double& time, double& error) const
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (count_ == 0)
+                        return false;
+                time = host_time(firmware_seconds(micros));
+                error = error_;
+                return true;
+        }
+
+        ClockEstimate ClockEstimator::get_estimate() const
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ClockEstimate estimate;
+                estimate.samples = count_;
+                // The firmware time counts from the first sample.
+                estimate.offset = (count_ > 0)? offset_ + (double) epoch_ * 1.0e-6 : 0.0;
+                estimate.drift = drift_;
+                estimate.error = error_;
+                estimate.request_delay = request_delay_;
+                estimate.response_delay = response_delay_;
+                return estimate;
+        }
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_CLOCKESTIMATOR_H
+#define __ROMISERIAL_CLOCKESTIMATOR_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+namespace romiserial {
+
+        struct ClockEstimate
+        {
+                size_t samples;
+                // The time of the firmware minus the time of the
+                // host, in seconds, at the time of the last sample.
+                double offset;
+                // The rate of the firmware clock relative to the
+                // host clock, minus one (1.0e-6 is 1 ppm).
+                double drift;
+                // The expected error of to_host_time() for the times
+                // covered by the samples.
+                double error;
+                // The smoothed delays between the host sending a
+                // request and the firmware starting its response,
+                // and between the start of the response and its
+                // arrival on the host.
+                double request_delay;
+                double response_delay;
+        };
+
+        /**
+         *  Maps the micros() timestamps of the firmware to the
+         *  monotonic clock of the host (see rmonotonic()), in the
+         *  manner of NTP. Each request with a timestamped response
+         *  gives a sample: the firmware time F was read at some host
+         *  time between the sending of the request, t1, and the
+         *  arrival of the response, t4. The offset F - h is
+         *  therefore F - (t1 + t4) / 2, give or take (t4 - t1) / 2.
+         *
+         *  As in the clock filter of NTP, only the sample with the
+         *  shortest round trip is kept for each interval of one
+         *  second, so that the window spans enough time to measure
+         *  the drift. The offset and the drift are fitted to these
+         *  samples by weighted least squares. The weights are the inverse of
+         *  the squared uncertainties, so that the samples with the
+         *  shortest round trips dominate. The error is the weighted
+         *  RMS of the residuals plus the smallest uncertainty of the
+         *  samples: the fit is no better than its best sample.
+         *
+         *  The estimator is updated by the I/O thread of the client
+         *  and can be read from any thread.
+         */
+        class ClockEstimator
+        {
+        public:
+                static constexpr size_t kDefaultWindow = 32;
+                static constexpr double kSampleInterval = 1.0;
+                static constexpr double kAlpha = 0.125;
+                // The uncertainty of a sample is at least one tick
+                // of the firmware clock.
+                static constexpr double kMinimumUncertainty = 1.0e-6;
+                
+        protected:
+                struct Sample {
+                        double host;
+                        double firmware;
+                        double uncertainty;
+                };
+
+                mutable std::mutex mutex_;
+                std::vector<Sample> samples_;
+                size_t next_;
+                size_t count_;
+                double interval_start_;
+                // The firmware time of the first sample, and of the
+                // last one, in microseconds, without wrap-around.
+                int64_t epoch_;
+                int64_t last_micros_;
+                double reference_;
+                double offset_;
+                double drift_;
+                double error_;
+                // The delays are seeded by the first sample only.
+                bool has_delays_;
+                double request_delay_;
+                double response_delay_;
+
+                int64_t unwrap(uint32_t micros) const;
+                double firmware_seconds(uint32_t micros) const;
+                double host_time(double firmware) const;
+                void fit();
+                
+        public:
+                explicit ClockEstimator(size_t window = kDefaultWindow);
+                ~ClockEstimator() = default;
+
+                /** Adds the times at which the request was sent and
+                 * the response was received, and the timestamp of
+                 * the response. */
+                void add_sample(double sent, double received, uint32_t micros);
+
+                /** Converts a timestamp of the firmware to the time of
+                 * the host clock. Returns false when there are no
+                 * samples yet. The timestamp must lie within 35
+                 * minutes of the last sample. */
+                bool to_host_time(uint32_t micros, double& time, double& error) const;
+
+                ClockEstimate get_estimate() const;
+                void reset();
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_CLOCKESTIMATOR_H
@@ -0,0 +1,78 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "CommandTemplate.h"
+#include "MessageParser.h"
+#include "RomiSerialErrors.h"
+
+namespace romiserial {
+
+        CommandTemplate::CommandTemplate(char opcode)
+                : prefix_(), error_(0)
+        {
+                char prefix[2] = { opcode, '\0' };
+                error_ = prefix_.encode(prefix);
+        }
+
+        CommandTemplate::CommandTemplate(const char *prefix)
+                : prefix_(), error_(0)
+        {
+                error_ = prefix_.encode(prefix);
+        }
+
+        int CommandTemplate::encode(EnvelopeEncoder& encoder,
+                                    const int16_t *args, size_t count) const
+        {
+                int err = error_;
+
+                if (err == 0 && count > PARSER_MAXIMUM_ARGUMENTS)
+                        err = kVectorTooLong;
+
+                if (err == 0) {
+                        encoder = prefix_;
+                        if (count > 0) {
+                                err = encoder.append('[');
+                                for (size_t i = 0; err == 0 && i < count; i++) {
+                                        if (i > 0)
+                                                err = encoder.append(',');
+                                        if (err == 0)
+                                                err = encoder.append_int(args[i]);
+                                }
+                                if (err == 0)
+                                        err = encoder.append(']');
+                        }
+                }
+                return err;
+        }
+
+        int CommandTemplate::encode(EnvelopeEncoder& encoder, const char *suffix) const
+        {
+                int err = error_;
+                if (err == 0) {
+                        encoder = prefix_;
+                        err = encoder.append(suffix);
+                }
+                return err;
+        }
+}
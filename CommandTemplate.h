@@ -0,0 +1,83 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_COMMANDTEMPLATE_H
+#define __ROMISERIAL_COMMANDTEMPLATE_H
+
+#include <stdint.h>
+#include "EnvelopeEncoder.h"
+
+namespace romiserial {
+
+        /**
+         *  A command that is sent repeatedly with, at most, different
+         *  arguments. The static prefix, the opcode followed by
+         *  optional fixed characters, is validated and encoded once
+         *  and the CRC state after the prefix is kept. A request
+         *  built from the template only copies the prefix and
+         *  updates the CRC over the variable part and the ID.
+         *
+         *    CommandTemplate move('V');
+         *    int16_t speeds[] = { 10, -10 };
+         *    request.set_command(move, speeds, 2);  // V[10,-10]
+         */
+        class CommandTemplate
+        {
+        protected:
+                EnvelopeEncoder prefix_;
+                int error_;
+
+        public:
+                explicit CommandTemplate(char opcode);
+                explicit CommandTemplate(const char *prefix);
+                ~CommandTemplate() = default;
+
+                /** Zero if the prefix is valid, or one of the errors
+                 * returned by EnvelopeEncoder::encode(). */
+                int error() const {
+                        return error_;
+                }
+
+                char opcode() const {
+                        return *prefix_.message();
+                }
+
+                /** Copies the encoded prefix, and its CRC state, into
+                 * the encoder. */
+                void start(EnvelopeEncoder& encoder) const {
+                        encoder = prefix_;
+                }
+
+                /** Copies the prefix into the encoder and appends
+                 * the arguments, as "[a,b,...]". No brackets are
+                 * appended when count is zero. */
+                int encode(EnvelopeEncoder& encoder,
+                           const int16_t *args, size_t count) const;
+
+                /** Copies the prefix into the encoder and appends
+                 * the string as is. */
+                int encode(EnvelopeEncoder& encoder, const char *suffix) const;
+        };
+}
+
+#endif // __ROMISERIAL_COMMANDTEMPLATE_H
@@ -0,0 +1,127 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <stdexcept>
+#include "DeviceGroup.h"
+#include "rtime.h"
+
+namespace romiserial {
+
+        DeviceGroup::DeviceGroup()
+                : devices_()
+        {
+        }
+
+        void DeviceGroup::add(const std::string& name,
+                              std::shared_ptr<IRomiSerialClient> client)
+        {
+                devices_[name] = client;
+        }
+
+        void DeviceGroup::remove(const std::string& name)
+        {
+                devices_.erase(name);
+        }
+
+        std::shared_ptr<IRomiSerialClient> DeviceGroup::get(const std::string& name) const
+        {
+                std::shared_ptr<IRomiSerialClient> client;
+                auto entry = devices_.find(name);
+                if (entry != devices_.end())
+                        client = entry->second;
+                return client;
+        }
+
+        GroupResponses DeviceGroup::broadcast(const char *command, double timeout)
+        {
+                std::vector<std::string> names;
+                std::vector<const char*> commands;
+                
+                for (auto& entry : devices_) {
+                        names.push_back(entry.first);
+                        commands.push_back(command);
+                }
+                return send_all(names, commands, timeout);
+        }
+
+        GroupResponses DeviceGroup::gather(const std::map<std::string, std::string>& commands,
+                                           double timeout)
+        {
+                std::vector<std::string> names;
+                std::vector<const char*> pointers;
+                
+                for (auto& entry : commands) {
+                        if (devices_.find(entry.first) == devices_.end())
+                                throw std::runtime_error("DeviceGroup::gather: "
+                                                         "Unknown device");
+                        names.push_back(entry.first);
+                        pointers.push_back(entry.second.c_str());
+                }
+                return send_all(names, pointers, timeout);
+        }
+
+        GroupResponses DeviceGroup::send_all(const std::vector<std::string>& names,
+                                             const std::vector<const char*>& commands,
+                                             double timeout)
+        {
+                size_t n = names.size();
+                std::unique_ptr<ClientRequest[]> requests(new ClientRequest[n]);
+                double deadline = (timeout > 0.0)? rtime() + timeout : 0.0;
+                GroupResponses responses;
+
+                // Submit everything first, then wait.
+                for (size_t i = 0; i < n; i++) {
+                        requests[i].set_command(commands[i]);
+                        requests[i].set_deadline(deadline);
+                        devices_[names[i]]->submit(requests[i]);
+                }
+
+                // The responses are collected until the deadline. A
+                // request that has not completed by then fails with
+                // kDeadlineExceeded.
+                for (size_t i = 0; i < n; i++) {
+                        Response& response = responses[names[i]];
+                        if (deadline > 0.0) {
+                                int status = requests[i].wait_until(deadline);
+                                if (requests[i].is_complete())
+                                        response = requests[i].response();
+                                else
+                                        response.set_error(status);
+                        } else {
+                                requests[i].wait();
+                                response = requests[i].response();
+                        }
+                }
+
+                // The clients drop the expired requests within
+                // kRomiSerialClientCancelPoll, and then release them.
+                for (size_t i = 0; i < n; i++)
+                        requests[i].wait();
+                return responses;
+        }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_DEVICEGROUP_H
+#define __ROMISERIAL_DEVICEGROUP_H
+
+#if !defined(ARDUINO)
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <IRomiSerialClient.h>
+#include <ClientRequest.h>
+
+namespace romiserial {
+
+        typedef std::map<std::string, Response> GroupResponses;
+
+        /**
+         *  A set of named devices that are queried together. The
+         *  requests are submitted to all the clients before waiting
+         *  for any response, so they are on the links at the same
+         *  time and a round costs about as much as the slowest
+         *  device. No threads are created: each client already has
+         *  its own I/O thread.
+         *
+         *  An optional timeout bounds the whole round. Requests that
+         *  are not answered in time fail with kDeadlineExceeded.
+         */
+        class DeviceGroup
+        {
+        protected:
+                std::map<std::string, std::shared_ptr<IRomiSerialClient>> devices_;
+
+                GroupResponses send_all(const std::vector<std::string>& names,
+                                        const std::vector<const char*>& commands,
+                                        double timeout);
+                
+        public:
+                DeviceGroup();
+                ~DeviceGroup() = default;
+
+                /** Adds a device. A device with the same name is
+                 * replaced. */
+                void add(const std::string& name,
+                         std::shared_ptr<IRomiSerialClient> client);
+                void remove(const std::string& name);
+
+                /** The client of the device, or nullptr if there is
+                 * none with that name. */
+                std::shared_ptr<IRomiSerialClient> get(const std::string& name) const;
+                
+                size_t size() const {
+                        return devices_.size();
+                }
+
+                /** Sends the same command to all the devices and
+                 * waits for all the responses. A timeout of zero
+                 * leaves it to the response timeouts of the
+                 * clients. */
+                GroupResponses broadcast(const char *command, double timeout = 0.0);
+
+                /** Sends one command to each of the given devices and
+                 * waits for all the responses. Throws
+                 * std::runtime_error if a device is unknown. */
+                GroupResponses gather(const std::map<std::string, std::string>& commands,
+                                      double timeout = 0.0);
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_DEVICEGROUP_H
@@ -0,0 +1,105 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "EnvelopeEncoder.h"
+#include "RomiSerialErrors.h"
+#include "RomiSerialUtil.h"
+
+namespace romiserial {
+
+        EnvelopeEncoder::EnvelopeEncoder()
+                : length_(0), message_length_(0), crc_()
+        {
+        }
+
+        void EnvelopeEncoder::append_hex(uint8_t value, CRC8& crc)
+        {
+                char c = to_hex((uint8_t)(value >> 4));
+                crc.update(c);
+                buffer_[length_++] = c;
+                c = to_hex(value);
+                crc.update(c);
+                buffer_[length_++] = c;
+        }
+
+        void EnvelopeEncoder::append_hex_no_crc(uint8_t value)
+        {
+                buffer_[length_++] = to_hex((uint8_t)(value >> 4));
+                buffer_[length_++] = to_hex(value);
+        }
+
+        int EnvelopeEncoder::encode(const char *command)
+        {
+                int err = kNoError;
+                size_t length = strnlen(command, MAX_MESSAGE_LENGTH + 1);
+
+                length_ = 0;
+                message_length_ = 0;
+                crc_.start();
+
+                if (length == 0) {
+                        err = kEmptyRequest;
+                } else if (length > MAX_MESSAGE_LENGTH) {
+                        err = kClientTooLong;
+                } else if (!is_valid_opcode(command[0])) {
+                        err = kInvalidOpcode;
+                } else {
+                        append_char('#');
+                        for (size_t i = 0; i < length; i++)
+                                append_char(command[i]);
+                }
+                return err;
+        }
+
+        int EnvelopeEncoder::append(const char *s, size_t length)
+        {
+                int err = kClientTooLong;
+                if (has_space(length)) {
+                        for (size_t i = 0; i < length; i++)
+                                append_char(s[i]);
+                        err = kNoError;
+                }
+                return err;
+        }
+
+        int EnvelopeEncoder::append(const char *s)
+        {
+                return append(s, strlen(s));
+        }
+
+        void EnvelopeEncoder::finalize(uint16_t id, bool long_id)
+        {
+                CRC8 crc(crc_);
+
+                length_ = message_length_;
+                crc.update(':');
+                buffer_[length_++] = ':';
+                if (long_id)
+                        append_hex((uint8_t) (id >> 8), crc);
+                append_hex((uint8_t) id, crc);
+                append_hex_no_crc(crc.get());
+                buffer_[length_++] = '\r';
+                buffer_[length_++] = '\n';
+        }
+}
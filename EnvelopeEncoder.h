@@ -0,0 +1,144 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_ENVELOPE_ENCODER_H
+#define __ROMISERIAL_ENVELOPE_ENCODER_H
+
+#include "CRC8.h"
+#include "EnvelopeParser.h"
+#include "RomiSerialErrors.h"
+
+namespace romiserial {
+
+        /* '#' + message + ':' + id (2 or 4) + crc (2) + '\r' + '\n' */
+#define MAX_ENVELOPE_LENGTH (MAX_MESSAGE_LENGTH + 10)
+
+        /**
+         *  Encodes a request into a fixed buffer without allocating
+         *  memory. The CRC is computed while the characters are
+         *  written. The encoding is done in two steps: encode()
+         *  validates and writes the message, finalize() adds the
+         *  metadata. Only the latter depends on the ID so the message
+         *  can be prepared by the caller's thread.
+         *
+         *  The encoder can be copied. A copy made after the opcode
+         *  has been written keeps the CRC state of the prefix (see
+         *  CommandTemplate).
+         */
+        class EnvelopeEncoder
+        {
+        protected:
+                char buffer_[MAX_ENVELOPE_LENGTH];
+                uint8_t length_;
+                uint8_t message_length_;
+                CRC8 crc_;
+
+                void append_char(char c) {
+                        // The metadata separator cannot appear in the message.
+                        if (c == ':')
+                                c = '-';
+                        crc_.update(c);
+                        buffer_[message_length_++] = c;
+                }
+
+                void append_hex(uint8_t value, CRC8& crc);
+                void append_hex_no_crc(uint8_t value);
+
+                bool has_space(size_t n) const {
+                        return message_length_ + n <= MAX_MESSAGE_LENGTH + 1;
+                }
+
+        public:
+                EnvelopeEncoder();
+                ~EnvelopeEncoder() = default;
+
+                /** Validates the command and writes '#' followed by
+                 * the command. Returns zero or one of the error codes
+                 * kEmptyRequest, kClientTooLong, or kInvalidOpcode. */
+                int encode(const char *command);
+
+                /** Appends characters to the message. These functions
+                 * return kClientTooLong if the message would become
+                 * longer than MAX_MESSAGE_LENGTH. Nothing is appended
+                 * in that case. */
+                int append(char c) {
+                        int err = kClientTooLong;
+                        if (has_space(1)) {
+                                append_char(c);
+                                err = kNoError;
+                        }
+                        return err;
+                }
+
+                int append(const char *s);
+                int append(const char *s, size_t length);
+
+                int append_int(int32_t value) {
+                        char digits[11];
+                        uint8_t n = 0;
+                        uint32_t v = (value < 0)? (uint32_t) (-(int64_t) value) : (uint32_t) value;
+
+                        do {
+                                digits[n++] = (char) ('0' + v % 10);
+                                v /= 10;
+                        } while (v != 0);
+                        if (value < 0)
+                                digits[n++] = '-';
+
+                        int err = kClientTooLong;
+                        if (has_space(n)) {
+                                while (n > 0)
+                                        append_char(digits[--n]);
+                                err = kNoError;
+                        }
+                        return err;
+                }
+
+                /** Appends the metadata and the end of the
+                 * envelope. The ID is written with four hex digits if
+                 * long_id is true, otherwise only its lower byte is
+                 * written. It can be called again, with a different
+                 * ID, on the same message. */
+                void finalize(uint16_t id, bool long_id = false);
+
+                const char *data() const {
+                        return buffer_;
+                }
+
+                uint8_t length() const {
+                        return length_;
+                }
+
+                /** The command, without the leading '#'. It is not
+                 * zero-terminated. */
+                const char *message() const {
+                        return buffer_ + 1;
+                }
+
+                uint8_t message_length() const {
+                        return (message_length_ > 0)? (uint8_t) (message_length_ - 1) : 0;
+                }
+        };
+}
+
+#endif // __ROMISERIAL_ENVELOPE_ENCODER_H
@@ -33,12 +33,16 @@ namespace romiserial {
 #define END_ENVELOPE(_c)        ((_c) == '\n')
 #define START_METADATA(_c)      ((_c) == ':')
 #define DUMMY_METADATA_CHAR(_c) ((_c) == 'x')
+#define START_TIMESTAMP(_c)     ((_c) == 't')
 #define VALID_HEX_CHAR(_c)      (('a' <= (_c) && (_c) <= 'f')           \
                                  || ('0' <= (_c) && (_c) <= '9'))
         
-        EnvelopeParser::EnvelopeParser()
+        EnvelopeParser::EnvelopeParser(char *buffer, uint16_t capacity)
                 : _state(expect_start_envelope), _error(0), _crc(),
-                  _id(0), _has_id(0), _crc_metadata(0), _message_length(0)
+                  _id(0), _has_id(false), _long_id(false), _metadata_digits(0),
+                  _metadata(0), _crc_after_2(0), _crc_after_4(0),
+                  _has_timestamp(false), _timestamp(0), _message(buffer),
+                  _capacity(capacity), _message_length(0)
         {
                 reset();
         }
@@ -81,7 +85,7 @@ namespace romiserial {
 
         void EnvelopeParser::append_char(char c)
         {
-                if (_message_length < MAX_MESSAGE_LENGTH) {
+                if (_message_length < _capacity) {
                         _message[_message_length++] = c;
                 } else {
                         set_error(c, kEnvelopeTooLong);
@@ -94,9 +98,98 @@ namespace romiserial {
                 _message_length = 0;
                 _error = kNoError;
                 _crc.start();
-                _crc_metadata = 0;
+                _metadata_digits = 0;
+                _metadata = 0;
                 _id = 0;
                 _has_id = false;
+                _long_id = false;
+                _has_timestamp = false;
+                _timestamp = 0;
+        }
+
+        // The digits are added to the CRC until it is known which
+        // of them are the CRC itself.
+        void EnvelopeParser::append_metadata_digit(char c)
+        {
+                _metadata = (_metadata << 4) | hex_to_int(c);
+                _metadata_digits++;
+                _crc.update(c);
+                if (_metadata_digits == 2)
+                        _crc_after_2 = _crc.get();
+                else if (_metadata_digits == 4)
+                        _crc_after_4 = _crc.get();
+        }
+
+        bool EnvelopeParser::end_metadata(char c)
+        {
+                uint8_t crc;
+                bool success = false;
+                
+                if (_metadata_digits == 4) {
+                        _id = (uint16_t) (_metadata >> 8);
+                        crc = _crc_after_2;
+                } else if (_metadata_digits == 6) {
+                        _id = (uint16_t) (_metadata >> 8);
+                        _long_id = true;
+                        crc = _crc_after_4;
+                } else {
+                        set_error(c, (_metadata_digits < 2)?
+                                  kEnvelopeInvalidId : kEnvelopeInvalidCrc);
+                        return false;
+                }
+                
+                _has_id = true;
+                if ((uint8_t) (_metadata & 0xff) == crc) {
+                        success = true;
+                } else {
+                        set_error(c, kEnvelopeCrcMismatch);
+#if defined(ARDUINO)
+                        Serial.print("#!");
+                        Serial.print("crc=");
+                        Serial.print(crc, HEX);
+                        Serial.print(":xxxx\r\n");
+#endif
+                }
+                return success;
+        }
+
+        // The ID is complete. The timestamp and the CRC follow.
+        void EnvelopeParser::start_timestamp(char c)
+        {
+                _id = (uint16_t) _metadata;
+                _long_id = (_metadata_digits == 4);
+                _has_timestamp = true;
+                _metadata = 0;
+                _metadata_digits = 0;
+                _crc.update(c);
+        }
+
+        void EnvelopeParser::append_timestamp_digit(char c)
+        {
+                if (_metadata_digits < 8) {
+                        _timestamp = (_timestamp << 4) | hex_to_int(c);
+                        _crc.update(c);
+                } else {
+                        _metadata = (_metadata << 4) | hex_to_int(c);
+                }
+                _metadata_digits++;
+        }
+
+        bool EnvelopeParser::end_timestamp(char c)
+        {
+                bool success = false;
+                
+                if (_metadata_digits != 10) {
+                        set_error(c, kEnvelopeInvalidCrc);
+                } else {
+                        _has_id = true;
+                        if ((uint8_t) _metadata == _crc.get()) {
+                                success = true;
+                        } else {
+                                set_error(c, kEnvelopeCrcMismatch);
+                        }
+                }
+                return success;
         }
 
         bool EnvelopeParser::process(char c)
@@ -138,53 +231,44 @@ namespace romiserial {
                                 _has_id = false;
                                 _state = expect_dummy_metadata_char_2;
                         } else if (VALID_HEX_CHAR(c)) {
-                                _has_id = true;
-                                _id = hex_to_int(c);
-                                _state = expect_id_char_2;
-                                _crc.update(c);
+                                append_metadata_digit(c);
+                                _state = expect_metadata_or_end;
                         } else {
                                 set_error(c, kEnvelopeInvalidId);
                         }
                         break;
                 
-                case expect_id_char_2:
-                        if (VALID_HEX_CHAR(c)) {
-                                _id = (uint8_t)(16 * _id + hex_to_int(c));
-                                _state = expect_crc_char_1;
-                                _crc.update(c);
-                        } else {
+                case expect_metadata_or_end:
+                        if (VALID_HEX_CHAR(c) && _metadata_digits < 6) {
+                                append_metadata_digit(c);
+                        } else if (END_METADATA(c)) {
+                                if (end_metadata(c)) {
+                                        append_char('\0');
+                                        _state = expect_end_envelope;
+                                }
+                        } else if (START_TIMESTAMP(c)
+                                   && (_metadata_digits == 2 || _metadata_digits == 4)) {
+                                start_timestamp(c);
+                                _state = expect_timestamp_or_end;
+                        } else if (VALID_HEX_CHAR(c)) {
+                                set_error(c, kEnvelopeExpectedEnd);
+                        } else if (_metadata_digits < 2) {
                                 set_error(c, kEnvelopeInvalidId);
-                        }
-                        break;
-                
-                case expect_crc_char_1:
-                        if (VALID_HEX_CHAR(c)) {
-                                _crc_metadata = hex_to_int(c);
-                                _state = expect_crc_char_2;
                         } else {
                                 set_error(c, kEnvelopeInvalidCrc);
                         }
                         break;
-                
-                case expect_crc_char_2:
-                        if (VALID_HEX_CHAR(c)) {
-                                uint8_t crc = _crc.finalize();
-                        
-                                _crc_metadata = (uint8_t)(16 * _crc_metadata + hex_to_int(c));
-                                if (_crc_metadata == crc) {
-                                        _state = expect_end_metadata;
-                                } else {
-                                        set_error(c, kEnvelopeCrcMismatch);
-#if defined(ARDUINO)
-                                        Serial.print("#!");
-                                        Serial.print("crc=");
-                                        Serial.print(crc, HEX);
-                                        Serial.print(":xxxx\r\n");
-#else
-                                        // r_warn("CRC mismatch: got %02x, expected %02x",
-                                        //        _crc_metadata, crc) ;
-#endif
+
+                case expect_timestamp_or_end:
+                        if (VALID_HEX_CHAR(c) && _metadata_digits < 10) {
+                                append_timestamp_digit(c);
+                        } else if (END_METADATA(c)) {
+                                if (end_timestamp(c)) {
+                                        append_char('\0');
+                                        _state = expect_end_envelope;
                                 }
+                        } else if (VALID_HEX_CHAR(c)) {
+                                set_error(c, kEnvelopeExpectedEnd);
                         } else {
                                 set_error(c, kEnvelopeInvalidCrc);
                         }
@@ -30,13 +30,23 @@ namespace romiserial {
 
 #define MAX_MESSAGE_LENGTH 58
 
+// The longest message the host accepts. Boards with more memory than
+// the Arduino Uno may send longer responses. Requests remain limited
+// to MAX_MESSAGE_LENGTH.
+#if !defined(MAX_RESPONSE_LENGTH)
+#if defined(ARDUINO)
+#define MAX_RESPONSE_LENGTH MAX_MESSAGE_LENGTH
+#else
+#define MAX_RESPONSE_LENGTH 1024
+#endif
+#endif
+
         enum envelope_parser_state_t {
                 expect_start_envelope = 0,
                 expect_payload_or_start_metadata,
                 expect_id_char_1,
-                expect_id_char_2,
-                expect_crc_char_1,
-                expect_crc_char_2,
+                expect_metadata_or_end,
+                expect_timestamp_or_end,
                 expect_dummy_metadata_char_2,
                 expect_dummy_metadata_char_3,
                 expect_dummy_metadata_char_4,
@@ -44,33 +54,78 @@ namespace romiserial {
                 expect_end_envelope
         };
 
+        /**
+         *  Parses the envelope of the incoming messages. The message
+         *  is stored in a buffer of capacity + 1 bytes that is owned
+         *  by the subclass, see StaticEnvelopeParser. Longer messages
+         *  fail with kEnvelopeTooLong.
+         *
+         *  The metadata is either "xxxx", a 2-digit ID and the CRC
+         *  (4 hex digits), or a 4-digit ID and the CRC (6 hex
+         *  digits). The two formats are told apart at the end of the
+         *  metadata, so the state of the CRC is kept after the
+         *  second and the fourth digit. When the firmware adds
+         *  timestamps, the ID is followed by a 't', the micros() of
+         *  the firmware (8 hex digits), and the CRC.
+         */
         class EnvelopeParser
         {
         protected:
                 envelope_parser_state_t _state;
                 int8_t _error;
                 CRC8 _crc;
-                uint8_t _id;
+                uint16_t _id;
                 bool _has_id;
-                uint8_t _crc_metadata;
-                char _message[MAX_MESSAGE_LENGTH+1];
-                uint8_t _message_length;
+                bool _long_id;
+                uint8_t _metadata_digits;
+                uint32_t _metadata;
+                uint8_t _crc_after_2;
+                uint8_t _crc_after_4;
+                bool _has_timestamp;
+                uint32_t _timestamp;
+                char *_message;
+                uint16_t _capacity;
+                uint16_t _message_length;
                 
                 void set_error(char character, int8_t what);
                 void append_char(char c);
+                void append_metadata_digit(char c);
+                bool end_metadata(char c);
+                void start_timestamp(char c);
+                void append_timestamp_digit(char c);
+                bool end_timestamp(char c);
+
+                EnvelopeParser(char *buffer, uint16_t capacity);
 
         public:
         
-                EnvelopeParser();
+                EnvelopeParser(const EnvelopeParser&) = delete;
+                EnvelopeParser& operator=(const EnvelopeParser&) = delete;
                 ~EnvelopeParser() = default;
 
-                uint8_t id() {
+                uint16_t id() {
                         return _id;
                 }
 
                 bool has_id() const {
                         return _has_id;
                 }
+
+                /** Whether the ID of the message has four hex
+                 * digits. */
+                bool has_long_id() const {
+                        return _long_id;
+                }
+
+                /** Whether the firmware added its micros() to the
+                 * message. */
+                bool has_timestamp() const {
+                        return _has_timestamp;
+                }
+
+                uint32_t timestamp() const {
+                        return _timestamp;
+                }
         
                 uint8_t crc() {
                         return _crc.get();
@@ -88,13 +143,37 @@ namespace romiserial {
                     return _message + 1 ; // Skip #
                 }
         
-                uint8_t length() const {
+                uint16_t length() const {
                         return _message_length;
                 }
+
+                uint16_t capacity() const {
+                        return _capacity;
+                }
         
                 void reset();
                 bool process(char c);
         };
+
+        /**
+         *  An EnvelopeParser with a static buffer for messages of up
+         *  to Capacity bytes, including the opcode and the final
+         *  zero. The firmware uses MAX_MESSAGE_LENGTH, the host
+         *  MAX_RESPONSE_LENGTH.
+         */
+        template <uint16_t Capacity>
+        class StaticEnvelopeParser : public EnvelopeParser
+        {
+        protected:
+                static_assert(Capacity < 0xffff, "The capacity is too large");
+                
+                char _buffer[Capacity + 1];
+
+        public:
+                StaticEnvelopeParser()
+                        : EnvelopeParser(_buffer, Capacity) {
+                }
+        };
 }
 
 #endif // __ROMISERIAL_ENVELOPE_PARSER_H
@@ -0,0 +1,128 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include "FirmwareLog.h"
+
+namespace romiserial {
+
+        FirmwareLog::FirmwareLog(std::shared_ptr<ILog> log,
+                                 const std::string& client_name,
+                                 size_t capacity)
+                : log_(log),
+                  client_name_(client_name),
+                  entries_(capacity + 1),
+                  head_(0),
+                  tail_(0),
+                  received_(0),
+                  dropped_(0),
+                  truncated_(0),
+                  signal_(0),
+                  quit_(false),
+                  thread_()
+        {
+                thread_ = std::thread(&FirmwareLog::run, this);
+        }
+
+        FirmwareLog::~FirmwareLog()
+        {
+                quit_.store(true, std::memory_order_release);
+                wake_up();
+                if (thread_.joinable())
+                        thread_.join();
+        }
+
+        bool FirmwareLog::post(const char *message, size_t length)
+        {
+                size_t tail = tail_.load(std::memory_order_relaxed);
+                size_t next = (tail + 1) % entries_.size();
+                bool success = false;
+
+                received_.fetch_add(1, std::memory_order_relaxed);
+                
+                if (next != head_.load(std::memory_order_acquire)) {
+                        char *text = entries_[tail].text;
+                        if (length > kMaxLength) {
+                                memcpy(text, message, kMaxLength - 3);
+                                memcpy(text + kMaxLength - 3, "...", 3);
+                                length = kMaxLength;
+                                truncated_.fetch_add(1, std::memory_order_relaxed);
+                        } else {
+                                memcpy(text, message, length);
+                        }
+                        text[length] = '\0';
+                        tail_.store(next, std::memory_order_release);
+                        wake_up();
+                        success = true;
+                } else {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+                return success;
+        }
+
+        void FirmwareLog::wake_up()
+        {
+                signal_.fetch_add(1, std::memory_order_release);
+                signal_.notify_one();
+        }
+
+        void FirmwareLog::run()
+        {
+                while (true) {
+                        uint32_t signal = signal_.load(std::memory_order_acquire);
+                        if (head_.load(std::memory_order_relaxed)
+                            != tail_.load(std::memory_order_acquire)) {
+                                drain();
+                        } else if (quit_.load(std::memory_order_acquire)) {
+                                break;
+                        } else {
+                                signal_.wait(signal, std::memory_order_acquire);
+                        }
+                }
+        }
+
+        void FirmwareLog::drain()
+        {
+                size_t head = head_.load(std::memory_order_relaxed);
+                while (head != tail_.load(std::memory_order_acquire)) {
+                        log_->debug("RomiSerialClient<%s>: Firmware says: '%s'",
+                                    client_name_.c_str(), entries_[head].text);
+                        head = (head + 1) % entries_.size();
+                        head_.store(head, std::memory_order_release);
+                }
+        }
+
+        FirmwareLogStatistics FirmwareLog::get_statistics() const
+        {
+                FirmwareLogStatistics statistics;
+                statistics.received = received_.load(std::memory_order_relaxed);
+                statistics.dropped = dropped_.load(std::memory_order_relaxed);
+                statistics.truncated = truncated_.load(std::memory_order_relaxed);
+                return statistics;
+        }
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_FIRMWARELOG_H
+#define __ROMISERIAL_FIRMWARELOG_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ILog.h>
+#include <EnvelopeParser.h>
+
+namespace romiserial {
+
+        struct FirmwareLogStatistics
+        {
+                uint32_t received;
+                // Log frames that found the queue full.
+                uint32_t dropped;
+                // Log frames that were cut to kMaxLength.
+                uint32_t truncated;
+        };
+
+        /**
+         *  Forwards the log frames of the firmware to the ILog of the
+         *  client without delaying the requests. The I/O thread
+         *  copies each frame into a bounded, lock-free,
+         *  single-producer single-consumer queue. A background
+         *  thread formats and prints them. When the queue is full,
+         *  new frames are dropped and counted.
+         *
+         *  The entries are as large as the longest frame the client
+         *  accepts, MAX_RESPONSE_LENGTH, so the messages are not
+         *  cut. Longer messages, if any, are truncated, marked with
+         *  "...", and counted.
+         */
+        class FirmwareLog
+        {
+        public:
+                static constexpr size_t kDefaultCapacity = 64;
+                static constexpr size_t kMaxLength = MAX_RESPONSE_LENGTH;
+                
+        protected:
+                struct Entry {
+                        char text[kMaxLength + 1];
+                };
+                
+                std::shared_ptr<ILog> log_;
+                const std::string client_name_;
+                std::vector<Entry> entries_;
+                std::atomic<size_t> head_;
+                std::atomic<size_t> tail_;
+                std::atomic<uint32_t> received_;
+                std::atomic<uint32_t> dropped_;
+                std::atomic<uint32_t> truncated_;
+                // Bumped to wake up the background thread.
+                std::atomic<uint32_t> signal_;
+                std::atomic<bool> quit_;
+                std::thread thread_;
+
+                void run();
+                void drain();
+                void wake_up();
+
+        public:
+                FirmwareLog(std::shared_ptr<ILog> log,
+                            const std::string& client_name,
+                            size_t capacity = kDefaultCapacity);
+                FirmwareLog(const FirmwareLog&) = delete;
+                FirmwareLog& operator=(const FirmwareLog&) = delete;
+                
+                /** Prints the frames that are still queued. */
+                ~FirmwareLog();
+
+                /** Called by the I/O thread of the client. Messages
+                 * longer than kMaxLength are truncated. Returns false
+                 * if the queue is full. */
+                bool post(const char *message, size_t length);
+
+                FirmwareLogStatistics get_statistics() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_FIRMWARELOG_H
@@ -0,0 +1,111 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include "HandlerSchema.h"
+#include "MessageParser.h"
+#include "EnvelopeParser.h"
+#include "RomiSerialErrors.h"
+#include "RomiSerialUtil.h"
+
+namespace romiserial {
+
+        HandlerSchema::HandlerSchema()
+                : entries_(),
+                  features_(0),
+                  loaded_(false)
+        {
+        }
+
+        void HandlerSchema::clear()
+        {
+                loaded_.store(false, std::memory_order_release);
+                memset(entries_, 0, sizeof(entries_));
+                features_ = 0;
+        }
+
+        void HandlerSchema::add(const HandlerInfo& info)
+        {
+                if ((info.opcode & 0x80) == 0) {
+                        Entry& entry = entries_[(int) info.opcode];
+                        entry.known = true;
+                        entry.number_arguments = info.number_arguments;
+                        entry.requires_string = info.requires_string;
+                }
+        }
+
+        void HandlerSchema::set_loaded(int features)
+        {
+                features_ = features;
+                loaded_.store(true, std::memory_order_release);
+        }
+
+        bool HandlerSchema::get(char opcode, HandlerInfo& info) const
+        {
+                bool found = false;
+                if (is_loaded() && (opcode & 0x80) == 0 && entries_[(int) opcode].known) {
+                        const Entry& entry = entries_[(int) opcode];
+                        info.opcode = opcode;
+                        info.number_arguments = entry.number_arguments;
+                        info.requires_string = entry.requires_string;
+                        found = true;
+                }
+                return found;
+        }
+
+        int HandlerSchema::validate(const char *message, size_t length) const
+        {
+                char buffer[MAX_MESSAGE_LENGTH + 1];
+                MessageParser parser;
+                
+                if (!is_loaded()
+                    || length == 0
+                    || length > MAX_MESSAGE_LENGTH
+                    || message[0] == kIntrospectionOpcode
+                    || message[0] == kHeartbeatOpcode
+                    || message[0] == kClockOpcode)
+                        return kNoError;
+
+                // The parser expects the terminating zero, as in
+                // the envelope parser.
+                memcpy(buffer, message, length);
+                buffer[length] = '\0';
+                
+                if (!parser.parse(buffer, length + 1))
+                        return parser.error();
+
+                const Entry& entry = entries_[(int) (parser.opcode() & 0x7f)];
+                if (!entry.known)
+                        return kUnknownOpcode;
+                if (parser.length() != entry.number_arguments)
+                        return kBadNumberOfArguments;
+                if (parser.has_string() != entry.requires_string)
+                        return entry.requires_string? kMissingString : kBadString;
+                return kNoError;
+        }
+}
+
+#endif
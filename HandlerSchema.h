@@ -0,0 +1,98 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_HANDLERSCHEMA_H
+#define __ROMISERIAL_HANDLERSCHEMA_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace romiserial {
+
+        /** The description of a firmware handler. See
+         * MessageHandler. */
+        struct HandlerInfo
+        {
+                char opcode;
+                uint8_t number_arguments;
+                bool requires_string;
+        };
+
+        /**
+         *  The handler table of the firmware, as returned by the
+         *  introspection opcode. It lets the client reject malformed
+         *  requests without sending them. The same checks as the
+         *  firmware are made, in the same order, so the same error
+         *  codes are returned.
+         *
+         *  The table is filled once by the client, and then only
+         *  read.
+         */
+        class HandlerSchema
+        {
+        protected:
+                struct Entry {
+                        bool known;
+                        uint8_t number_arguments;
+                        bool requires_string;
+                };
+
+                Entry entries_[128];
+                int features_;
+                std::atomic<bool> loaded_;
+
+        public:
+                HandlerSchema();
+                ~HandlerSchema() = default;
+
+                void clear();
+                void add(const HandlerInfo& info);
+                
+                /** Enables the validation once all the handlers are
+                 * added. */
+                void set_loaded(int features);
+                
+                bool is_loaded() const {
+                        return loaded_.load(std::memory_order_acquire);
+                }
+
+                int features() const {
+                        return features_;
+                }
+
+                bool get(char opcode, HandlerInfo& info) const;
+
+                /** Checks an encoded message: the opcode followed by
+                 * the arguments, not zero-terminated. Returns zero if
+                 * the schema is not loaded or if the message is
+                 * valid. Otherwise, it returns the error code the
+                 * firmware would have returned. */
+                int validate(const char *message, size_t length) const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_HANDLERSCHEMA_H
@@ -34,6 +34,16 @@ namespace romiserial {
         public:
                 virtual ~IOutputStream() = default;
                 virtual bool write(char c) = 0;
+
+                /** Writes a buffer. Streams that can send several
+                 * bytes at once should override this function. */
+                virtual bool write(const char *data, size_t length) {
+                        for (size_t i = 0; i < length; i++) {
+                                if (!write(data[i]))
+                                        return false;
+                        }
+                        return true;
+                }
         };
 }
 
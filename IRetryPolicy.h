@@ -0,0 +1,51 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_IRETRYPOLICY_H
+#define __ROMISERIAL_IRETRYPOLICY_H
+
+namespace romiserial {
+
+        class IRetryPolicy
+        {
+        public:
+                virtual ~IRetryPolicy() = default;
+
+                /**
+                 *  Called by the client after a request failed.
+                 *
+                 *  opcode: the opcode of the request.
+                 *  attempt: the number of times the request was
+                 *  sent, starting at 1.
+                 *  code: the status code of the failed attempt.
+                 *  delay: set to the time, in seconds, to wait before
+                 *  sending the request again.
+                 *
+                 *  Returns: true if the request should be sent again.
+                 */
+                virtual bool should_retry(char opcode, int attempt, int code,
+                                          double& delay) = 0;
+        };
+}
+
+#endif // __ROMISERIAL_IRETRYPOLICY_H
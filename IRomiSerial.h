@@ -53,6 +53,15 @@ namespace romiserial {
                 virtual void send_ok() = 0;
                 virtual void send_error(int code, const char *message) = 0;
                 virtual void send(const char *message) = 0;
+                /* Sends a frame outside of a request. The message is
+                 * a JSON array of the same form as a response,
+                 * [0,v1,v2,...]. The client dispatches it to the
+                 * subscribers of the topic. The default
+                 * implementation drops the frame. */
+                virtual void push(char topic, const char *message) {
+                        (void) topic;
+                        (void) message;
+                }
                 /* virtual bool read(uint8_t *data, size_t length) = 0; */
                 /* virtual bool write(const uint8_t *data, size_t length) = 0; */
                 virtual void log(const char *message) = 0;
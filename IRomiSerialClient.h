@@ -24,10 +24,12 @@
 #ifndef __ROMISERIAL_IROMISERIALCLIENT_H
 #define __ROMISERIAL_IROMISERIALCLIENT_H
 
-#include <json.hpp>
+#include <json_fwd.hpp>
 
 namespace romiserial {
 
+        class ClientRequest;
+
         class IRomiSerialClient
         {
         public:
@@ -39,6 +41,9 @@ namespace romiserial {
                  *
                  *  command: the string representation of the request.
                  *
+                 *  The JSON types are only declared here. Include
+                 *  RomiSerialJson.h to build or read the response.
+                 *
                  *  Returns: An Json array. The first element of the array is
                  *  a number that indicates whether the request was
                  *  successfully handled or not. A value of zero means
@@ -51,6 +56,12 @@ namespace romiserial {
                  */
                 virtual void send(const char *request, nlohmann::json& response) = 0;
 
+                /** Submits a request without waiting for the
+                 * response. This function does not block. Use
+                 * request.wait() or request.is_complete() to find out
+                 * when the response is available. */
+                virtual void submit(ClientRequest& request) = 0;
+
                 /* virtual bool read(uint8_t *data, size_t length) = 0; */
                 /* virtual bool write(const uint8_t *data, size_t length) = 0; */
 
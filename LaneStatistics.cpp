@@ -0,0 +1,75 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include "LaneStatistics.h"
+
+namespace romiserial {
+
+        LaneCounters::LaneCounters()
+                : requests_(0),
+                  total_queue_wait_(0.0),
+                  max_queue_wait_(0.0),
+                  total_link_wait_(0.0),
+                  max_link_wait_(0.0)
+        {
+        }
+
+        void LaneCounters::add(std::atomic<double>& total, double value)
+        {
+                total.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void LaneCounters::update_max(std::atomic<double>& max, double value)
+        {
+                double current = max.load(std::memory_order_relaxed);
+                while (value > current
+                       && !max.compare_exchange_weak(current, value,
+                                                     std::memory_order_relaxed))
+                        ;
+        }
+
+        void LaneCounters::record(double queue_wait, double link_wait)
+        {
+                add(total_queue_wait_, queue_wait);
+                update_max(max_queue_wait_, queue_wait);
+                add(total_link_wait_, link_wait);
+                update_max(max_link_wait_, link_wait);
+                requests_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        LaneStatistics LaneCounters::get() const
+        {
+                LaneStatistics stats;
+                stats.requests = requests_.load(std::memory_order_relaxed);
+                stats.total_queue_wait = total_queue_wait_.load(std::memory_order_relaxed);
+                stats.max_queue_wait = max_queue_wait_.load(std::memory_order_relaxed);
+                stats.total_link_wait = total_link_wait_.load(std::memory_order_relaxed);
+                stats.max_link_wait = max_link_wait_.load(std::memory_order_relaxed);
+                return stats;
+        }
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_LANESTATISTICS_H
+#define __ROMISERIAL_LANESTATISTICS_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <atomic>
+
+namespace romiserial {
+
+        /**
+         *  The waiting times of the requests of one priority class.
+         *  The queue wait is the time between the submission of a
+         *  request and the moment the I/O thread picks it up. The
+         *  link wait is the time from then until the request
+         *  completes. All times are in seconds.
+         */
+        struct LaneStatistics
+        {
+                uint32_t requests;
+                double total_queue_wait;
+                double max_queue_wait;
+                double total_link_wait;
+                double max_link_wait;
+        };
+
+        /** The counters behind LaneStatistics. They are updated
+         * with atomic read-modify-write operations and can be
+         * written and read from any thread. */
+        class LaneCounters
+        {
+        protected:
+                std::atomic<uint32_t> requests_;
+                std::atomic<double> total_queue_wait_;
+                std::atomic<double> max_queue_wait_;
+                std::atomic<double> total_link_wait_;
+                std::atomic<double> max_link_wait_;
+
+                static void add(std::atomic<double>& total, double value);
+                static void update_max(std::atomic<double>& max, double value);
+
+        public:
+                LaneCounters();
+
+                void record(double queue_wait, double link_wait);
+                LaneStatistics get() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_LANESTATISTICS_H
@@ -0,0 +1,197 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <bit>
+#include "LinkMetrics.h"
+
+namespace romiserial {
+
+        LatencySnapshot::LatencySnapshot()
+                : count(0), min(0.0), max(0.0), mean(0.0), buckets()
+        {
+        }
+
+        double LatencySnapshot::percentile(double fraction) const
+        {
+                if (count == 0)
+                        return 0.0;
+                
+                uint64_t rank = (uint64_t) (fraction * (double) count + 0.5);
+                if (rank < 1)
+                        rank = 1;
+                
+                uint64_t seen = 0;
+                for (size_t i = 0; i < buckets.size(); i++) {
+                        seen += buckets[i];
+                        if (seen >= rank) {
+                                uint64_t upper = LatencyHistogram::lower_bound(i + 1) - 1;
+                                double value = (double) upper * 1.0e-6;
+                                return (value < max)? value : max;
+                        }
+                }
+                return max;
+        }
+
+        // The first 16 buckets count the values 0 to 15 µs. Above
+        // that, the exponent selects a group of 16 buckets and the
+        // next four bits select the bucket in the group.
+        size_t LatencyHistogram::index_of(uint64_t micros)
+        {
+                if (micros < (uint64_t) kSubBuckets)
+                        return (size_t) micros;
+                
+                int exponent = 63 - std::countl_zero(micros);
+                if (exponent > kMaxExponent)
+                        return kBuckets - 1;
+                
+                uint64_t sub = (micros >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+                return (size_t) ((exponent - kSubBucketBits + 1) * kSubBuckets) + (size_t) sub;
+        }
+
+        uint64_t LatencyHistogram::lower_bound(size_t index)
+        {
+                if (index < (size_t) kSubBuckets)
+                        return index;
+                
+                int exponent = (int) (index / kSubBuckets) + kSubBucketBits - 1;
+                uint64_t sub = index % kSubBuckets;
+                return (kSubBuckets + sub) << (exponent - kSubBucketBits);
+        }
+
+        LatencyHistogram::LatencyHistogram()
+                : buckets_(),
+                  count_(0),
+                  total_(0),
+                  min_(UINT64_MAX),
+                  max_(0)
+        {
+        }
+
+        void LatencyHistogram::record(double seconds)
+        {
+                uint64_t micros = (seconds > 0.0)? (uint64_t) (seconds * 1.0e6) : 0;
+                std::atomic<uint32_t>& bucket = buckets_[index_of(micros)];
+                
+                bucket.fetch_add(1, std::memory_order_relaxed);
+                total_.fetch_add(micros, std::memory_order_relaxed);
+
+                uint64_t min = min_.load(std::memory_order_relaxed);
+                while (micros < min
+                       && !min_.compare_exchange_weak(min, micros,
+                                                      std::memory_order_relaxed))
+                        ;
+                uint64_t max = max_.load(std::memory_order_relaxed);
+                while (micros > max
+                       && !max_.compare_exchange_weak(max, micros,
+                                                      std::memory_order_relaxed))
+                        ;
+                count_.fetch_add(1, std::memory_order_release);
+        }
+
+        LatencySnapshot LatencyHistogram::get() const
+        {
+                LatencySnapshot snapshot;
+                
+                snapshot.count = count_.load(std::memory_order_acquire);
+                if (snapshot.count > 0) {
+                        snapshot.min = (double) min_.load(std::memory_order_relaxed) * 1.0e-6;
+                        snapshot.max = (double) max_.load(std::memory_order_relaxed) * 1.0e-6;
+                        snapshot.mean = ((double) total_.load(std::memory_order_relaxed)
+                                         * 1.0e-6 / (double) snapshot.count);
+                }
+                
+                snapshot.buckets.resize(kBuckets);
+                for (size_t i = 0; i < (size_t) kBuckets; i++)
+                        snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+                return snapshot;
+        }
+
+        LinkMetrics::OpcodeMetrics::OpcodeMetrics()
+                : requests(0),
+                  retries(0),
+                  timeouts(0),
+                  id_mismatches(0),
+                  crc_errors(0),
+                  latency()
+        {
+        }
+
+        LinkMetrics::LinkMetrics()
+                : bytes_in_(0),
+                  bytes_out_(0),
+                  opcodes_()
+        {
+        }
+
+        LinkMetrics::~LinkMetrics()
+        {
+                for (size_t i = 0; i < 128; i++)
+                        delete opcodes_[i].load(std::memory_order_relaxed);
+        }
+
+        LinkMetrics::OpcodeMetrics& LinkMetrics::get(char opcode)
+        {
+                std::atomic<OpcodeMetrics*>& slot = opcodes_[opcode & 0x7f];
+                OpcodeMetrics *metrics = slot.load(std::memory_order_acquire);
+                if (metrics == nullptr) {
+                        // Another thread may allocate the same slot.
+                        OpcodeMetrics *created = new OpcodeMetrics();
+                        if (slot.compare_exchange_strong(metrics, created,
+                                                         std::memory_order_acq_rel)) {
+                                metrics = created;
+                        } else {
+                                delete created;
+                        }
+                }
+                return *metrics;
+        }
+
+        LinkMetricsSnapshot LinkMetrics::get() const
+        {
+                LinkMetricsSnapshot snapshot;
+                
+                snapshot.bytes_in = bytes_in_.load(std::memory_order_relaxed);
+                snapshot.bytes_out = bytes_out_.load(std::memory_order_relaxed);
+                
+                for (size_t i = 0; i < 128; i++) {
+                        const OpcodeMetrics *metrics = opcodes_[i].load(std::memory_order_acquire);
+                        if (metrics != nullptr) {
+                                OpcodeMetricsSnapshot opcode;
+                                opcode.opcode = (char) i;
+                                opcode.requests = metrics->requests.load(std::memory_order_relaxed);
+                                opcode.retries = metrics->retries.load(std::memory_order_relaxed);
+                                opcode.timeouts = metrics->timeouts.load(std::memory_order_relaxed);
+                                opcode.id_mismatches = metrics->id_mismatches.load(std::memory_order_relaxed);
+                                opcode.crc_errors = metrics->crc_errors.load(std::memory_order_relaxed);
+                                opcode.latency = metrics->latency.get();
+                                snapshot.opcodes.push_back(opcode);
+                        }
+                }
+                return snapshot;
+        }
+}
+
+#endif
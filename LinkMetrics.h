@@ -0,0 +1,196 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_LINKMETRICS_H
+#define __ROMISERIAL_LINKMETRICS_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+namespace romiserial {
+
+        /**
+         *  A copy of a LatencyHistogram. The values are in seconds.
+         */
+        class LatencySnapshot
+        {
+        public:
+                uint64_t count;
+                double min;
+                double max;
+                double mean;
+                // The number of samples per bucket. See
+                // LatencyHistogram.
+                std::vector<uint32_t> buckets;
+
+                LatencySnapshot();
+
+                /** The smallest value such that the given fraction of
+                 * the samples (0 to 1) is not larger. The result is
+                 * the upper bound of a bucket, so it overestimates
+                 * the exact value by less than 1/16. */
+                double percentile(double fraction) const;
+        };
+
+        /**
+         *  A latency histogram with log-linear buckets in the style
+         *  of HdrHistogram. The values are counted in microseconds.
+         *  Each power of two is split into 16 buckets, so the
+         *  relative error is below 6.25% from 1 µs up to more than
+         *  half an hour, with a fixed memory footprint.
+         *
+         *  Values can be recorded and snapshots taken from any
+         *  thread.
+         */
+        class LatencyHistogram
+        {
+        public:
+                static constexpr int kSubBucketBits = 4;
+                static constexpr int kSubBuckets = 1 << kSubBucketBits;
+                static constexpr int kMaxExponent = 31;
+                static constexpr int kBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+                static size_t index_of(uint64_t micros);
+                static uint64_t lower_bound(size_t index);
+
+        protected:
+                std::atomic<uint32_t> buckets_[kBuckets];
+                std::atomic<uint64_t> count_;
+                std::atomic<uint64_t> total_;
+                std::atomic<uint64_t> min_;
+                std::atomic<uint64_t> max_;
+
+        public:
+                LatencyHistogram();
+
+                void record(double seconds);
+                LatencySnapshot get() const;
+        };
+
+        struct OpcodeMetricsSnapshot
+        {
+                char opcode;
+                uint64_t requests;
+                uint64_t retries;
+                uint64_t timeouts;
+                // Responses that were dropped because their ID did
+                // not match the request.
+                uint64_t id_mismatches;
+                uint64_t crc_errors;
+                LatencySnapshot latency;
+        };
+
+        struct LinkMetricsSnapshot
+        {
+                uint64_t bytes_in;
+                uint64_t bytes_out;
+                // Only the opcodes that were used.
+                std::vector<OpcodeMetricsSnapshot> opcodes;
+        };
+
+        /**
+         *  Always-on counters of a client: the bytes on the link and,
+         *  per opcode, the requests, retries, timeouts, dropped
+         *  responses, CRC errors, and the latency of the requests.
+         *  The counters of an opcode are allocated when it is first
+         *  used.
+         *
+         *  The counters are incremented with atomic read-modify-write
+         *  operations, so they can be updated from several threads.
+         *  get() can be called from any thread.
+         */
+        class LinkMetrics
+        {
+        public:
+                struct OpcodeMetrics {
+                        std::atomic<uint64_t> requests;
+                        std::atomic<uint64_t> retries;
+                        std::atomic<uint64_t> timeouts;
+                        std::atomic<uint64_t> id_mismatches;
+                        std::atomic<uint64_t> crc_errors;
+                        LatencyHistogram latency;
+
+                        OpcodeMetrics();
+                };
+
+        protected:
+                std::atomic<uint64_t> bytes_in_;
+                std::atomic<uint64_t> bytes_out_;
+                std::atomic<OpcodeMetrics*> opcodes_[128];
+
+                static void increment(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+                        counter.fetch_add(n, std::memory_order_relaxed);
+                }
+
+        public:
+                LinkMetrics();
+                LinkMetrics(const LinkMetrics&) = delete;
+                LinkMetrics& operator=(const LinkMetrics&) = delete;
+                ~LinkMetrics();
+
+                /** The counters of the opcode, allocated on first
+                 * use. */
+                OpcodeMetrics& get(char opcode);
+                
+                void count_bytes_in(size_t n) {
+                        increment(bytes_in_, n);
+                }
+
+                void count_bytes_out(size_t n) {
+                        increment(bytes_out_, n);
+                }
+
+                void count_request(char opcode) {
+                        increment(get(opcode).requests);
+                }
+
+                void count_retry(char opcode) {
+                        increment(get(opcode).retries);
+                }
+
+                void count_timeout(char opcode) {
+                        increment(get(opcode).timeouts);
+                }
+
+                void count_id_mismatch(char opcode) {
+                        increment(get(opcode).id_mismatches);
+                }
+
+                void count_crc_error(char opcode) {
+                        increment(get(opcode).crc_errors);
+                }
+
+                void record_latency(char opcode, double seconds) {
+                        get(opcode).latency.record(seconds);
+                }
+
+                LinkMetricsSnapshot get() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_LINKMETRICS_H
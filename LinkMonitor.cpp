@@ -0,0 +1,107 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#if !defined(ARDUINO)
+
+#include "LinkMonitor.h"
+
+namespace romiserial {
+
+        LinkMonitor::LinkMonitor()
+                : last_frame_(0.0),
+                  silent_until_(0.0),
+                  down_(false),
+                  heartbeats_(0),
+                  missed_heartbeats_(0),
+                  failures_(0),
+                  rejected_requests_(0)
+        {
+        }
+
+        void LinkMonitor::reset(double now)
+        {
+                last_frame_.store(now, std::memory_order_relaxed);
+                down_.store(false, std::memory_order_release);
+        }
+
+        bool LinkMonitor::frame_received(double now)
+        {
+                last_frame_.store(now, std::memory_order_relaxed);
+                bool was_down = down_.load(std::memory_order_relaxed);
+                if (was_down)
+                        down_.store(false, std::memory_order_release);
+                return was_down;
+        }
+
+        void LinkMonitor::allow_silence(double until)
+        {
+                silent_until_.store(until, std::memory_order_relaxed);
+        }
+
+        bool LinkMonitor::check(double now, double threshold)
+        {
+                bool declared = false;
+                if (!down_.load(std::memory_order_relaxed)
+                    && silence(now) > threshold
+                    && now > silent_until_.load(std::memory_order_relaxed)) {
+                        down_.store(true, std::memory_order_release);
+                        failures_.fetch_add(1, std::memory_order_relaxed);
+                        declared = true;
+                }
+                return declared;
+        }
+
+        double LinkMonitor::silence(double now) const
+        {
+                return now - last_frame_.load(std::memory_order_relaxed);
+        }
+
+        void LinkMonitor::count_heartbeat()
+        {
+                heartbeats_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void LinkMonitor::count_missed_heartbeat()
+        {
+                missed_heartbeats_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void LinkMonitor::count_rejected_request()
+        {
+                rejected_requests_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        LinkHealth LinkMonitor::get_health(double now) const
+        {
+                LinkHealth health;
+                health.up = !is_down();
+                health.silence = silence(now);
+                health.heartbeats = heartbeats_.load(std::memory_order_relaxed);
+                health.missed_heartbeats = missed_heartbeats_.load(std::memory_order_relaxed);
+                health.failures = failures_.load(std::memory_order_relaxed);
+                health.rejected_requests = rejected_requests_.load(std::memory_order_relaxed);
+                return health;
+        }
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_LINKMONITOR_H
+#define __ROMISERIAL_LINKMONITOR_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <atomic>
+
+namespace romiserial {
+
+        struct LinkHealth
+        {
+                bool up;
+                // The time since the last frame of the firmware, in
+                // seconds.
+                double silence;
+                uint32_t heartbeats;
+                // Heartbeats that got no answer in time.
+                uint32_t missed_heartbeats;
+                // The number of times the link was declared down.
+                uint32_t failures;
+                // Requests that failed with kLinkDown.
+                uint32_t rejected_requests;
+        };
+
+        /**
+         *  Tracks whether the firmware is still alive. The I/O thread
+         *  of the client reports every complete frame it receives.
+         *  When it sends a request whose handler has a declared
+         *  budget, it also reports until when the firmware may stay
+         *  silent. The heartbeat thread calls check() periodically:
+         *  the link is declared down when the firmware has been
+         *  silent for longer than the threshold, even while a
+         *  request is on the link. The next frame brings it back
+         *  up.
+         */
+        class LinkMonitor
+        {
+        protected:
+                std::atomic<double> last_frame_;
+                std::atomic<double> silent_until_;
+                std::atomic<bool> down_;
+                std::atomic<uint32_t> heartbeats_;
+                std::atomic<uint32_t> missed_heartbeats_;
+                std::atomic<uint32_t> failures_;
+                std::atomic<uint32_t> rejected_requests_;
+
+        public:
+                LinkMonitor();
+
+                /** Marks the link as up, as if a frame was just
+                 * received. */
+                void reset(double now);
+
+                /** Called by the I/O thread for each complete
+                 * frame. Returns true if the link was down. */
+                bool frame_received(double now);
+
+                /** Called by the I/O thread when it sends a request
+                 * whose handler may take until the given time to
+                 * respond. */
+                void allow_silence(double until);
+
+                /** Returns true if the link was declared down by
+                 * this call. */
+                bool check(double now, double threshold);
+
+                bool is_down() const {
+                        return down_.load(std::memory_order_acquire);
+                }
+
+                double silence(double now) const;
+                
+                void count_heartbeat();
+                void count_missed_heartbeat();
+                void count_rejected_request();
+                
+                LinkHealth get_health(double now) const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_LINKMONITOR_H
@@ -0,0 +1,112 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef __ROMISERIAL_MPSCQUEUE_H
+#define __ROMISERIAL_MPSCQUEUE_H
+
+#include <atomic>
+
+namespace romiserial {
+
+        /**
+         *  The link field of an object that can be put in an
+         *  MPSCQueue. The queue does not own its nodes and does not
+         *  allocate memory: the object must remain valid until it has
+         *  been popped by the consumer.
+         */
+        class MPSCNode
+        {
+        public:
+                std::atomic<MPSCNode*> queue_next_;
+
+                MPSCNode() : queue_next_(nullptr) {}
+                MPSCNode(const MPSCNode&) = delete;
+                MPSCNode& operator=(const MPSCNode&) = delete;
+                ~MPSCNode() = default;
+        };
+
+        /**
+         *  An intrusive, lock-free, multiple-producer single-consumer
+         *  FIFO queue (D. Vyukov). Pushing is wait-free and costs one
+         *  atomic exchange. Only one thread may call pop().
+         *
+         *  pop() may return nullptr while a producer is half-way
+         *  through a push. The consumer should therefore use a
+         *  separate signal to find out when to look again (see
+         *  RomiSerialClient).
+         */
+        template <typename T>
+        class MPSCQueue
+        {
+        protected:
+                std::atomic<MPSCNode*> head_;
+                MPSCNode *tail_;
+                MPSCNode stub_;
+
+                void push_node(MPSCNode *node) {
+                        node->queue_next_.store(nullptr, std::memory_order_relaxed);
+                        MPSCNode *prev = head_.exchange(node, std::memory_order_acq_rel);
+                        prev->queue_next_.store(node, std::memory_order_release);
+                }
+
+        public:
+                MPSCQueue() : head_(&stub_), tail_(&stub_), stub_() {}
+                MPSCQueue(const MPSCQueue&) = delete;
+                MPSCQueue& operator=(const MPSCQueue&) = delete;
+                ~MPSCQueue() = default;
+
+                void push(T *item) {
+                        push_node(item);
+                }
+
+                T *pop() {
+                        MPSCNode *tail = tail_;
+                        MPSCNode *next = tail->queue_next_.load(std::memory_order_acquire);
+                        if (tail == &stub_) {
+                                if (next == nullptr)
+                                        return nullptr;
+                                tail_ = next;
+                                tail = next;
+                                next = next->queue_next_.load(std::memory_order_acquire);
+                        }
+                        if (next != nullptr) {
+                                tail_ = next;
+                                return static_cast<T*>(tail);
+                        }
+                        if (tail != head_.load(std::memory_order_acquire)) {
+                                // A producer is in the middle of a push.
+                                return nullptr;
+                        }
+                        push_node(&stub_);
+                        next = tail->queue_next_.load(std::memory_order_acquire);
+                        if (next != nullptr) {
+                                tail_ = next;
+                                return static_cast<T*>(tail);
+                        }
+                        return nullptr;
+                }
+        };
+}
+
+#endif // __ROMISERIAL_MPSCQUEUE_H
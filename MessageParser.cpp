@@ -44,7 +44,10 @@ namespace romiserial {
 #define VALID_OPCODE(_c)      (('a' <= (_c) && (_c) <= 'z')     \
                                || ('A' <= (_c) && (_c) <= 'Z')  \
                                || ('0' <= (_c) && (_c) <= '9')  \
-                               || ((_c) == '?'))
+                               || ((_c) == '?')                 \
+                               || ((_c) == '$')                 \
+                               || ((_c) == '~')                 \
+                               || ((_c) == '@'))
 #define VALID_STRING_CHAR(_c) (('a' <= (_c) && (_c) <= 'z')             \
                                || ('A' <= (_c) && (_c) <= 'Z')          \
                                || ('0' <= (_c) && (_c) <= '9')          \
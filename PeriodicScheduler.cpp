@@ -0,0 +1,359 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <map>
+#include <stdexcept>
+#include "PeriodicScheduler.h"
+#include "Console.h"
+#include "Tracer.h"
+
+namespace romiserial {
+
+        PeriodicScheduler::Job::Job()
+                : scheduler(nullptr),
+                  client(nullptr),
+                  period(0.0),
+                  callback(),
+                  request(),
+                  next_run(0.0),
+                  sent_at(0.0),
+                  in_flight(false),
+                  completed(false),
+                  first_run(0.0),
+                  last_run(0.0),
+                  statistics(),
+                  total_jitter(0.0),
+                  total_latency(0.0)
+        {
+        }
+
+        PeriodicScheduler::PeriodicScheduler()
+                : PeriodicScheduler(std::make_shared<Console>())
+        {
+        }
+
+        PeriodicScheduler::PeriodicScheduler(std::shared_ptr<ILog> log)
+                : log_(log),
+                  jobs_(),
+                  mutex_(),
+                  timer_fd_(-1),
+                  event_fd_(-1),
+                  epoll_fd_(-1),
+                  pending_(0),
+                  quit_(false),
+                  running_(false),
+                  thread_()
+        {
+                timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+                event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+                epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+                if (timer_fd_ < 0 || event_fd_ < 0 || epoll_fd_ < 0) {
+                        if (timer_fd_ >= 0) close(timer_fd_);
+                        if (event_fd_ >= 0) close(event_fd_);
+                        if (epoll_fd_ >= 0) close(epoll_fd_);
+                        throw std::runtime_error("PeriodicScheduler: "
+                                                 "Failed to create the timer");
+                }
+                
+                struct epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.fd = timer_fd_;
+                epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event);
+                event.data.fd = event_fd_;
+                epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &event);
+        }
+
+        PeriodicScheduler::~PeriodicScheduler()
+        {
+                stop();
+                close(epoll_fd_);
+                close(event_fd_);
+                close(timer_fd_);
+        }
+
+        double PeriodicScheduler::now()
+        {
+                struct timespec spec;
+                clock_gettime(CLOCK_MONOTONIC, &spec);
+                return (double) spec.tv_sec + (double) spec.tv_nsec / 1.0e9;
+        }
+
+        int PeriodicScheduler::add_job(IRomiSerialClient& client, const char *command,
+                                       double rate, JobCallback callback)
+        {
+                if (is_running() || !(rate > 0.0))
+                        return -1;
+                
+                std::unique_ptr<Job> job = std::make_unique<Job>();
+                if (job->request.set_command(command) != 0)
+                        return -1;
+                
+                job->scheduler = this;
+                job->client = &client;
+                job->period = 1.0 / rate;
+                job->callback = callback;
+                job->request.set_completion_callback(handle_completion, job.get());
+                
+                jobs_.push_back(std::move(job));
+                return (int) jobs_.size() - 1;
+        }
+
+        void PeriodicScheduler::start()
+        {
+                if (is_running())
+                        return;
+
+                // Cleans up after a thread that stopped on an error.
+                stop();
+                
+                quit_.store(false, std::memory_order_relaxed);
+                running_.store(true, std::memory_order_release);
+                spread_jobs(now());
+                thread_ = std::thread(&PeriodicScheduler::run, this);
+        }
+
+        void PeriodicScheduler::stop()
+        {
+                if (!thread_.joinable())
+                        return;
+                
+                quit_.store(true, std::memory_order_release);
+                signal();
+                thread_.join();
+
+                // The jobs cannot be sent again, or destroyed, before
+                // their requests have completed.
+                uint32_t pending = pending_.load(std::memory_order_acquire);
+                while (pending > 0) {
+                        pending_.wait(pending, std::memory_order_acquire);
+                        pending = pending_.load(std::memory_order_acquire);
+                }
+
+                // Also waits until the last completion callback has
+                // released the mutex.
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& job : jobs_) {
+                        job->in_flight = false;
+                        job->completed.store(false, std::memory_order_relaxed);
+                }
+        }
+
+        bool PeriodicScheduler::is_running() const
+        {
+                return running_.load(std::memory_order_acquire);
+        }
+
+        JobStatistics PeriodicScheduler::get_statistics(int index) const
+        {
+                JobStatistics statistics = {};
+                if (index >= 0 && (size_t) index < jobs_.size()) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        const Job& job = *jobs_[(size_t) index];
+                        statistics = job.statistics;
+                        uint64_t runs = statistics.runs;
+                        if (runs > 1 && job.last_run > job.first_run)
+                                statistics.rate = (double) (runs - 1)
+                                        / (job.last_run - job.first_run);
+                        if (runs > 0)
+                                statistics.mean_jitter = job.total_jitter / (double) runs;
+                        uint64_t responses = runs - (job.in_flight? 1 : 0);
+                        if (responses > 0)
+                                statistics.mean_latency = job.total_latency
+                                        / (double) responses;
+                }
+                return statistics;
+        }
+
+        /* The jobs of one client are spread evenly over the shortest
+         * period of these jobs. */
+        void PeriodicScheduler::spread_jobs(double start)
+        {
+                std::map<IRomiSerialClient*, std::vector<Job*>> clients;
+                for (auto& job : jobs_)
+                        clients[job->client].push_back(job.get());
+
+                for (auto& entry : clients) {
+                        std::vector<Job*>& jobs = entry.second;
+                        double period = jobs[0]->period;
+                        for (Job *job : jobs)
+                                period = std::min(period, job->period);
+                        for (size_t i = 0; i < jobs.size(); i++)
+                                jobs[i]->next_run = start + period * (double) i
+                                        / (double) jobs.size();
+                }
+        }
+
+        void PeriodicScheduler::handle_completion(void *context)
+        {
+                Job *job = static_cast<Job*>(context);
+                PeriodicScheduler *scheduler = job->scheduler;
+                job->completed.store(true, std::memory_order_release);
+                scheduler->signal();
+
+                // stop() takes the mutex after the count drops to
+                // zero, so the scheduler stays alive until the
+                // notification is done.
+                std::lock_guard<std::mutex> lock(scheduler->mutex_);
+                scheduler->pending_.fetch_sub(1, std::memory_order_release);
+                scheduler->pending_.notify_all();
+        }
+
+        void PeriodicScheduler::signal()
+        {
+                uint64_t value = 1;
+                ssize_t n = write(event_fd_, &value, sizeof(value));
+                (void) n;
+        }
+
+        void PeriodicScheduler::run()
+        {
+                Tracer::set_thread_name("PeriodicScheduler");
+
+                while (!quit_.load(std::memory_order_acquire)) {
+                        arm_timer();
+                        
+                        struct epoll_event events[2];
+                        int n = epoll_wait(epoll_fd_, events, 2, -1);
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n < 0) {
+                                log_->error("PeriodicScheduler: epoll_wait failed: %s",
+                                            strerror(errno));
+                                break;
+                        }
+                        
+                        for (int i = 0; i < n; i++) {
+                                uint64_t value;
+                                ssize_t r = read(events[i].data.fd, &value, sizeof(value));
+                                (void) r;
+                        }
+
+                        collect_responses();
+                        if (!quit_.load(std::memory_order_acquire))
+                                send_due_requests();
+                }
+
+                running_.store(false, std::memory_order_release);
+        }
+
+        void PeriodicScheduler::arm_timer()
+        {
+                struct itimerspec spec = {};
+                
+                if (!jobs_.empty()) {
+                        double next = jobs_[0]->next_run;
+                        for (auto& job : jobs_)
+                                next = std::min(next, job->next_run);
+                        double seconds = floor(next);
+                        spec.it_value.tv_sec = (time_t) seconds;
+                        spec.it_value.tv_nsec = (long) ((next - seconds) * 1.0e9);
+                        // A zero value would disarm the timer.
+                        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+                                spec.it_value.tv_nsec = 1;
+                }
+                
+                timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+        }
+
+        void PeriodicScheduler::collect_responses()
+        {
+                for (auto& job : jobs_) {
+                        if (job->completed.exchange(false, std::memory_order_acquire)) {
+                                const Response& response = job->request.response();
+                                double latency = now() - job->sent_at;
+                                {
+                                        std::lock_guard<std::mutex> lock(mutex_);
+                                        job->in_flight = false;
+                                        job->total_latency += latency;
+                                        job->statistics.max_latency
+                                                = std::max(job->statistics.max_latency,
+                                                           latency);
+                                        if (response.status() != 0)
+                                                job->statistics.errors++;
+                                }
+                                if (job->callback)
+                                        job->callback(response);
+                        }
+                }
+        }
+
+        /* The requests are sent at fixed times: the next time is
+         * computed from the previous time, not from the time the
+         * request was sent. Periods that were missed entirely are
+         * skipped. */
+        void PeriodicScheduler::send_due_requests()
+        {
+                double t = now();
+                for (auto& job : jobs_) {
+                        if (job->next_run > t)
+                                continue;
+                        
+                        if (job->in_flight) {
+                                std::lock_guard<std::mutex> lock(mutex_);
+                                job->statistics.overruns++;
+                        } else {
+                                send_request(*job, t);
+                        }
+                        
+                        job->next_run += job->period;
+                        if (job->next_run <= t) {
+                                double missed = floor((t - job->next_run) / job->period) + 1.0;
+                                job->next_run += missed * job->period;
+                                std::lock_guard<std::mutex> lock(mutex_);
+                                job->statistics.overruns += (uint64_t) missed;
+                        }
+                }
+        }
+
+        void PeriodicScheduler::send_request(Job& job, double t)
+        {
+                double jitter = t - job.next_run;
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if (job.statistics.runs == 0)
+                                job.first_run = t;
+                        job.last_run = t;
+                        job.statistics.runs++;
+                        job.total_jitter += jitter;
+                        job.statistics.max_jitter = std::max(job.statistics.max_jitter,
+                                                             jitter);
+                        job.in_flight = true;
+                }
+                job.sent_at = t;
+                pending_.fetch_add(1, std::memory_order_relaxed);
+                job.client->submit(job.request);
+        }
+}
+
+#endif
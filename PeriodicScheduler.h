@@ -0,0 +1,163 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_PERIODICSCHEDULER_H
+#define __ROMISERIAL_PERIODICSCHEDULER_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <IRomiSerialClient.h>
+#include <ClientRequest.h>
+#include "ILog.h"
+
+namespace romiserial {
+
+        struct JobStatistics
+        {
+                // The requests that were sent, and those that
+                // returned an error.
+                uint64_t runs;
+                uint64_t errors;
+                // The periods that were skipped because the previous
+                // request was still waiting for its response.
+                uint64_t overruns;
+                // The achieved number of requests per second.
+                double rate;
+                // How late the requests were sent, in seconds.
+                double mean_jitter;
+                double max_jitter;
+                // The time between sending a request and its
+                // response, in seconds.
+                double mean_latency;
+                double max_latency;
+        };
+
+        typedef std::function<void(const Response& response)> JobCallback;
+
+        /**
+         *  Sends requests at a fixed rate. Each job is a command that
+         *  is sent to a client at the given rate. The requests are
+         *  scheduled on absolute times of the monotonic clock, using
+         *  a timerfd, so the period does not drift with the
+         *  round-trip time.
+         *
+         *  The requests are submitted without waiting, so the jobs of
+         *  different devices run in parallel on the I/O threads of
+         *  their clients. The jobs of one device are spread over the
+         *  period so that they do not queue up behind each other. A
+         *  job whose previous request has not completed skips the
+         *  period, which is counted as an overrun.
+         *
+         *  The callbacks are called by the thread of the scheduler,
+         *  one at a time. They delay the next requests and should
+         *  return quickly.
+         */
+        class PeriodicScheduler
+        {
+        protected:
+                struct Job {
+                        PeriodicScheduler *scheduler;
+                        IRomiSerialClient *client;
+                        double period;
+                        JobCallback callback;
+                        ClientRequest request;
+                        double next_run;
+                        double sent_at;
+                        bool in_flight;
+                        std::atomic<bool> completed;
+                        double first_run;
+                        double last_run;
+                        JobStatistics statistics;
+                        double total_jitter;
+                        double total_latency;
+
+                        Job();
+                };
+
+                std::shared_ptr<ILog> log_;
+                std::vector<std::unique_ptr<Job>> jobs_;
+                // Guards the statistics of the jobs.
+                mutable std::mutex mutex_;
+                int timer_fd_;
+                int event_fd_;
+                int epoll_fd_;
+                // The requests whose completion callback has not
+                // returned yet.
+                std::atomic<uint32_t> pending_;
+                std::atomic<bool> quit_;
+                // False once the thread has stopped, also when it
+                // stopped on an error.
+                std::atomic<bool> running_;
+                std::thread thread_;
+
+                static double now();
+                static void handle_completion(void *context);
+                
+                void run();
+                void spread_jobs(double start);
+                void arm_timer();
+                void collect_responses();
+                void send_due_requests();
+                void send_request(Job& job, double now);
+                void signal();
+
+        public:
+                PeriodicScheduler();
+                explicit PeriodicScheduler(std::shared_ptr<ILog> log);
+                PeriodicScheduler(const PeriodicScheduler&) = delete;
+                PeriodicScheduler& operator=(const PeriodicScheduler&) = delete;
+                ~PeriodicScheduler();
+
+                /** Adds a job that sends the command to the client
+                 * rate times per second. The callback, if any,
+                 * receives each response. Returns the index of the
+                 * job, or -1 if the command or the rate is invalid or
+                 * the scheduler is running. The client must outlive
+                 * the scheduler. */
+                int add_job(IRomiSerialClient& client, const char *command,
+                            double rate, JobCallback callback = nullptr);
+
+                void start();
+
+                /** Stops sending requests and waits for the requests
+                 * that are in flight. */
+                void stop();
+
+                /** Returns false after stop(), or when the thread
+                 * stopped on an error, which is logged. */
+                bool is_running() const;
+
+                JobStatistics get_statistics(int job) const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_PERIODICSCHEDULER_H
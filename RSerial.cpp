@@ -35,6 +35,7 @@
 
 #include "RSerial.h"
 #include "rtime.h"
+#include "Tracer.h"
 
 namespace romiserial {
 
@@ -140,6 +141,27 @@ namespace romiserial {
                 return success;
         }
 
+        bool RSerial::write(const char *data, size_t length)
+        {
+                ROMISERIAL_TRACE_SCOPE("RSerial::write", "serial",
+                                       "bytes", (int64_t) length);
+                bool success = true;
+                size_t offset = 0;
+                while (offset < length) {
+                        ssize_t m = ::write(fd_, data + offset, length - offset);
+                        if (m > 0) {
+                                offset += (size_t) m;
+                        } else if (m < 0 && errno == EINTR) {
+                                continue;
+                        } else {
+                                log_->error("RSerial::write");
+                                success = false;
+                                break;
+                        }
+                }
+                return success;
+        }
+
         void RSerial::open_device()
         {
                 fd_ = open(device_.c_str(), O_RDWR | O_NOCTTY | O_SYNC);
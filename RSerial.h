@@ -64,6 +64,7 @@ namespace romiserial {
                 bool available() override;        
                 bool read(char& c) override;
                 bool write(char c) override;
+                bool write(const char *data, size_t length) override;
         };
 }
 
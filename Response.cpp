@@ -0,0 +1,355 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits>
+#include <json.hpp>
+#include "Response.h"
+#include "RomiSerialErrors.h"
+#include "Tracer.h"
+
+namespace romiserial {
+
+        Response::Response()
+                : status_(kConnectionTimeout), large_payload_(), length_(0),
+                  has_timestamp_(false), timestamp_(0), json_()
+        {
+                payload_[0] = '\0';
+        }
+
+        Response::~Response() = default;
+
+        Response::Response(const Response& other)
+                : status_(other.status_), large_payload_(), length_(0),
+                  has_timestamp_(other.has_timestamp_), timestamp_(other.timestamp_),
+                  json_()
+        {
+                copy_payload(other.payload(), other.length_);
+        }
+
+        Response& Response::operator=(const Response& other)
+        {
+                if (this != &other) {
+                        status_ = other.status_;
+                        has_timestamp_ = other.has_timestamp_;
+                        timestamp_ = other.timestamp_;
+                        copy_payload(other.payload(), other.length_);
+                        json_.reset();
+                }
+                return *this;
+        }
+
+        void Response::set_error(int code)
+        {
+                status_ = code;
+                length_ = 0;
+                has_timestamp_ = false;
+                payload_[0] = '\0';
+                json_.reset();
+        }
+
+        bool Response::set_payload(const char *s, size_t length)
+        {
+                bool success = false;
+                int code = 0;
+
+                if (length > MAX_RESPONSE_LENGTH)
+                        length = MAX_RESPONSE_LENGTH;
+                copy_payload(s, length);
+                has_timestamp_ = false;
+                json_.reset();
+
+                if (scan_status(payload(), code)) {
+                        status_ = code;
+                        success = true;
+                } else {
+                        status_ = kInvalidResponse;
+                }
+                return success;
+        }
+
+        void Response::copy_payload(const char *s, size_t length)
+        {
+                char *buffer = payload_;
+                if (length > MAX_MESSAGE_LENGTH) {
+                        large_payload_.resize(length + 1);
+                        buffer = large_payload_.data();
+                }
+                memcpy(buffer, s, length);
+                buffer[length] = '\0';
+                length_ = (uint16_t) length;
+        }
+
+        static inline const char *skip_spaces(const char *s)
+        {
+                while (*s == ' ' || *s == '\t')
+                        s++;
+                return s;
+        }
+
+        // Reads the status code at the start of "[code,...]" or
+        // "[code]".
+        bool Response::scan_status(const char *s, int& code)
+        {
+                int sign = 1;
+                int value = 0;
+                int digits = 0;
+
+                s = skip_spaces(s);
+                if (*s++ != '[')
+                        return false;
+                s = skip_spaces(s);
+                if (*s == '-') {
+                        sign = -1;
+                        s++;
+                }
+                while ('0' <= *s && *s <= '9') {
+                        if (++digits > 9)
+                                return false;
+                        value = 10 * value + (*s++ - '0');
+                }
+                if (digits == 0)
+                        return false;
+                s = skip_spaces(s);
+                if (*s != ',' && *s != ']')
+                        return false;
+
+                code = sign * value;
+                return true;
+        }
+
+        template <typename T>
+        static int store_value(int64_t value, size_t index, T *values, size_t capacity)
+        {
+                int err = kNoError;
+                if (index >= capacity) {
+                        err = kVectorTooLong;
+                } else if (value < std::numeric_limits<T>::min()
+                           || value > std::numeric_limits<T>::max()) {
+                        err = kValueOutOfRange;
+                } else {
+                        values[index] = (T) value;
+                }
+                return err;
+        }
+
+        // Decodes "[code,v1,v2,...]". Returns false if the payload
+        // is not an array of integers.
+        template <typename T>
+        static bool scan_values(const char *s, T *values, size_t capacity,
+                                size_t& count, int& err)
+        {
+                size_t index = 0;
+                size_t stored = 0;
+
+                err = kNoError;
+                s = skip_spaces(s);
+                if (*s++ != '[')
+                        return false;
+
+                while (true) {
+                        int64_t sign = 1;
+                        int64_t value = 0;
+                        int digits = 0;
+
+                        s = skip_spaces(s);
+                        if (*s == '-') {
+                                sign = -1;
+                                s++;
+                        }
+                        while ('0' <= *s && *s <= '9') {
+                                if (++digits > 18)
+                                        return false;
+                                value = 10 * value + (*s++ - '0');
+                        }
+                        if (digits == 0)
+                                return false;
+
+                        // The first value is the status code.
+                        if (index > 0 && err == kNoError) {
+                                err = store_value(sign * value, index - 1,
+                                                  values, capacity);
+                                if (err == kNoError)
+                                        stored++;
+                        }
+                        index++;
+
+                        s = skip_spaces(s);
+                        if (*s == ',') {
+                                s++;
+                        } else if (*s == ']') {
+                                s++;
+                                break;
+                        } else {
+                                return false;
+                        }
+                }
+
+                if (*skip_spaces(s) != '\0')
+                        return false;
+
+                count = stored;
+                return true;
+        }
+
+        // Converts a JSON number, or a string holding a number, to
+        // the nearest integer. Returns false for other values.
+        static bool json_to_integer(const nlohmann::json& value, int64_t& result)
+        {
+                double x;
+
+                if (value.is_number_integer()) {
+                        result = value.get<int64_t>();
+                        return true;
+                } else if (value.is_number()) {
+                        x = value.get<double>();
+                } else if (value.is_string()) {
+                        const std::string& s = value.get_ref<const std::string&>();
+                        char *end;
+                        x = strtod(s.c_str(), &end);
+                        if (s.empty() || *end != '\0')
+                                return false;
+                } else {
+                        return false;
+                }
+
+                // Out-of-range values are clamped, so that store_value()
+                // reports them as kValueOutOfRange.
+                if (isnan(x))
+                        return false;
+                else if (x > 1e15)
+                        result = (int64_t) 1e15;
+                else if (x < -1e15)
+                        result = (int64_t) -1e15;
+                else
+                        result = llround(x);
+                return true;
+        }
+
+        // Decodes the payloads that scan_values() rejects, such as
+        // arrays of floats or strings, using the lazily built JSON
+        // object of the response.
+        template <typename T>
+        static int parse_values(const Response& response, T *values,
+                                size_t capacity, size_t& count)
+        {
+                const nlohmann::json& data = response.json();
+                int err = data[0];
+
+                for (size_t i = 1; err == kNoError && i < data.size(); i++) {
+                        int64_t value;
+                        if (json_to_integer(data[i], value)) {
+                                err = store_value(value, i - 1, values, capacity);
+                                if (err == kNoError)
+                                        count = i;
+                        } else {
+                                err = kInvalidResponse;
+                        }
+                }
+                return err;
+        }
+
+        template <typename T>
+        static int decode_values(const Response& response, T *values,
+                                 size_t capacity, size_t& count)
+        {
+                int err = response.status();
+                count = 0;
+                if (err == kNoError
+                    && !scan_values(response.payload(), values, capacity, count, err)) {
+                        // Not a plain array of integers.
+                        count = 0;
+                        err = parse_values(response, values, capacity, count);
+                }
+                return err;
+        }
+
+        int Response::get_values(int16_t *values, size_t capacity, size_t& count) const
+        {
+                return decode_values(*this, values, capacity, count);
+        }
+
+        int Response::get_values(int32_t *values, size_t capacity, size_t& count) const
+        {
+                return decode_values(*this, values, capacity, count);
+        }
+
+        static nlohmann::json make_error(int code)
+        {
+                return nlohmann::json::array({code,
+                                        get_error_message(code)});
+        }
+
+        nlohmann::json Response::make_json() const
+        {
+                nlohmann::json data;
+
+                if (!has_payload())
+                        return make_error(status_);
+
+                ROMISERIAL_TRACE_SCOPE("json parse", "client", "bytes",
+                                       (int64_t) length_);
+                try {
+                        data = nlohmann::json::parse(payload());
+                } catch (nlohmann::json::parse_error& e) {
+                        return make_error(kInvalidJson);
+                }
+
+                // Check that the data is valid. If not, return an error.
+                if (data.is_array()
+                    && data.size() > 0
+                    && data[0].is_number()) {
+
+                        // If the response is an error message, make
+                        // sure it is valid, too: it should be an
+                        // array of length 2, with a string as second
+                        // element.
+                        int code = data[0];
+                        if (code != 0) {
+                                if (data.size() == 1) {
+                                        data[1] = get_error_message(code);
+                                } else if (data.size() != 2 || !data[1].is_string()) {
+                                        data = make_error(kInvalidErrorResponse);
+                                }
+                        }
+                } else {
+                        data = make_error(kInvalidResponse);
+                }
+
+                return data;
+        }
+
+        const nlohmann::json& Response::json() const
+        {
+                if (!json_)
+                        json_ = std::make_unique<nlohmann::json>(make_json());
+                return *json_;
+        }
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_RESPONSE_H
+#define __ROMISERIAL_RESPONSE_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
+#include <json_fwd.hpp>
+#include <EnvelopeParser.h>
+
+namespace romiserial {
+
+        /**
+         *  The response to a request. It holds the status code and a
+         *  copy of the raw payload sent by the firmware (a JSON
+         *  array). Errors that are detected by the client have a
+         *  status code but no payload. Payloads of up to
+         *  MAX_MESSAGE_LENGTH bytes are stored without allocating
+         *  memory. Longer ones, up to MAX_RESPONSE_LENGTH, are sent
+         *  by boards with more memory and are stored on the heap.
+         *
+         *  The status code is read with a small scanner when the
+         *  payload is set. The JSON object is only built when json()
+         *  is called for the first time. It is kept behind a pointer
+         *  so that this header only needs the forward declarations
+         *  of nlohmann::json. Include RomiSerialJson.h to use it. A
+         *  Response is not thread-safe.
+         */
+        class Response
+        {
+        protected:
+                int status_;
+                char payload_[MAX_MESSAGE_LENGTH + 1];
+                // The buffer of the long payloads. It is kept for
+                // the next one.
+                std::vector<char> large_payload_;
+                uint16_t length_;
+                bool has_timestamp_;
+                uint32_t timestamp_;
+                mutable std::unique_ptr<nlohmann::json> json_;
+
+                static bool scan_status(const char *s, int& code);
+                void copy_payload(const char *s, size_t length);
+                nlohmann::json make_json() const;
+
+        public:
+                Response();
+                Response(const Response& other);
+                Response& operator=(const Response& other);
+                ~Response();
+
+                /** Sets a client-side error. The payload is empty. */
+                void set_error(int code);
+
+                /** Copies the payload and scans the status code. It
+                 * returns false if the payload does not start with a
+                 * JSON array whose first element is an integer. */
+                bool set_payload(const char *s, size_t length);
+
+                /** Set by the client when the firmware timestamps
+                 * its responses. It is cleared by set_error() and
+                 * set_payload(). */
+                void set_timestamp(uint32_t micros) {
+                        timestamp_ = micros;
+                        has_timestamp_ = true;
+                }
+
+                bool has_timestamp() const {
+                        return has_timestamp_;
+                }
+
+                /** The micros() of the firmware when it started
+                 * sending the response. See
+                 * RomiSerialClient::to_host_time(). */
+                uint32_t timestamp() const {
+                        return timestamp_;
+                }
+
+                int status() const {
+                        return status_;
+                }
+
+                bool is_ok() const {
+                        return status_ == 0;
+                }
+
+                bool has_payload() const {
+                        return length_ > 0;
+                }
+
+                const char *payload() const {
+                        return (length_ > MAX_MESSAGE_LENGTH)?
+                                large_payload_.data() : payload_;
+                }
+
+                uint16_t length() const {
+                        return length_;
+                }
+
+                /** Decodes the values that follow the status code in
+                 * a response of the form [0,v1,v2,...] without
+                 * building a JSON object. Payloads of another shape,
+                 * such as arrays of floats or of strings holding
+                 * numbers, go through json(), and their values are
+                 * rounded to the nearest integer. Returns the status
+                 * code of the response, kInvalidResponse if a value
+                 * is not a number, or kValueOutOfRange or
+                 * kVectorTooLong if the values cannot be stored in
+                 * the array. count is set to the number of values
+                 * that were stored. */
+                int get_values(int16_t *values, size_t capacity, size_t& count) const;
+                int get_values(int32_t *values, size_t capacity, size_t& count) const;
+
+                /** The response as a JSON array, built on first use.
+                 * The first element is the status code. If it is not
+                 * zero, the second element is a human-readable error
+                 * message. See IRomiSerialClient::send(). */
+                const nlohmann::json& json() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_RESPONSE_H
@@ -0,0 +1,187 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include "ResponseCache.h"
+
+namespace romiserial {
+
+        ResponseCache::ResponseCache()
+                : mutex_(),
+                  entries_(),
+                  ttl_(),
+                  invalidates_(),
+                  capacity_(kDefaultCapacity),
+                  hits_(0),
+                  misses_(0),
+                  invalidations_(0)
+        {
+        }
+
+        void ResponseCache::set_ttl(char opcode, double seconds)
+        {
+                if (is_ascii(opcode)) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        ttl_[(int) opcode] = (seconds > 0.0)? seconds : 0.0;
+                        if (seconds <= 0.0)
+                                remove_opcode(opcode);
+                }
+        }
+
+        bool ResponseCache::is_cached(char opcode) const
+        {
+                return is_ascii(opcode) && ttl_[(int) opcode] > 0.0;
+        }
+
+        void ResponseCache::link(char write_opcode, char read_opcode)
+        {
+                if (is_ascii(write_opcode) && is_ascii(read_opcode)) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        invalidates_[(int) write_opcode].set((size_t) read_opcode);
+                }
+        }
+
+        bool ResponseCache::has_links(char opcode) const
+        {
+                return is_ascii(opcode) && invalidates_[(int) opcode].any();
+        }
+
+        void ResponseCache::set_capacity(size_t capacity)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                capacity_ = capacity;
+        }
+
+        bool ResponseCache::lookup(std::string_view command, Response& response,
+                                   double now)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                bool found = false;
+                
+                auto entry = entries_.find(command);
+                if (entry != entries_.end()) {
+                        if (now < entry->second.expires) {
+                                response = entry->second.response;
+                                found = true;
+                        } else {
+                                entries_.erase(entry);
+                        }
+                }
+
+                if (found)
+                        hits_++;
+                else
+                        misses_++;
+                return found;
+        }
+
+        void ResponseCache::store(std::string_view command, const Response& response,
+                                  double now)
+        {
+                if (command.empty() || !response.is_ok())
+                        return;
+                
+                std::lock_guard<std::mutex> lock(mutex_);
+                double ttl = ttl_[(int) (command[0] & 0x7f)];
+                if (ttl <= 0.0)
+                        return;
+
+                auto entry = entries_.find(command);
+                if (entry == entries_.end()) {
+                        if (entries_.size() >= capacity_)
+                                remove_expired(now);
+                        // The cache is full of valid entries. The
+                        // response is not stored.
+                        if (entries_.size() >= capacity_)
+                                return;
+                        entry = entries_.emplace(std::string(command), Entry()).first;
+                }
+                entry->second.response = response;
+                entry->second.expires = now + ttl;
+        }
+
+        void ResponseCache::invalidate_linked(char opcode)
+        {
+                if (!is_ascii(opcode))
+                        return;
+                std::lock_guard<std::mutex> lock(mutex_);
+                const std::bitset<128>& links = invalidates_[(int) opcode];
+                if (links.any()) {
+                        for (size_t i = 0; i < links.size(); i++) {
+                                if (links.test(i))
+                                        remove_opcode((char) i);
+                        }
+                        invalidations_++;
+                }
+        }
+
+        void ResponseCache::invalidate(char opcode)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                remove_opcode(opcode);
+                invalidations_++;
+        }
+
+        void ResponseCache::clear()
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                entries_.clear();
+                invalidations_++;
+        }
+
+        // The entries are sorted by command, so the entries of one
+        // opcode are contiguous.
+        void ResponseCache::remove_opcode(char opcode)
+        {
+                auto first = entries_.lower_bound(std::string_view(&opcode, 1));
+                auto last = first;
+                while (last != entries_.end() && last->first[0] == opcode)
+                        ++last;
+                entries_.erase(first, last);
+        }
+
+        void ResponseCache::remove_expired(double now)
+        {
+                for (auto entry = entries_.begin(); entry != entries_.end(); ) {
+                        if (now >= entry->second.expires)
+                                entry = entries_.erase(entry);
+                        else
+                                ++entry;
+                }
+        }
+
+        CacheStatistics ResponseCache::get_statistics() const
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                CacheStatistics stats;
+                stats.hits = hits_;
+                stats.misses = misses_;
+                stats.invalidations = invalidations_;
+                stats.entries = (uint32_t) entries_.size();
+                return stats;
+        }
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_RESPONSECACHE_H
+#define __ROMISERIAL_RESPONSECACHE_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <bitset>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <Response.h>
+
+namespace romiserial {
+
+        struct CacheStatistics
+        {
+                uint32_t hits;
+                uint32_t misses;
+                uint32_t invalidations;
+                uint32_t entries;
+        };
+
+        /**
+         *  Caches the successful responses of slowly changing
+         *  queries. The entries are keyed by the full command (opcode
+         *  and arguments) and expire after the time-to-live of their
+         *  opcode. Opcodes without a time-to-live are not cached.
+         *
+         *  An opcode can be linked to the opcodes whose responses it
+         *  changes. Sending it removes the cached responses of the
+         *  linked opcodes.
+         *
+         *  The cache is thread-safe. The time-to-live values and
+         *  the links are configuration and must be set before the
+         *  cache is used.
+         */
+        class ResponseCache
+        {
+        public:
+                static constexpr size_t kDefaultCapacity = 256;
+
+        protected:
+                struct Entry {
+                        Response response;
+                        double expires;
+                };
+
+                mutable std::mutex mutex_;
+                std::map<std::string, Entry, std::less<>> entries_;
+                double ttl_[128];
+                std::bitset<128> invalidates_[128];
+                size_t capacity_;
+                uint32_t hits_;
+                uint32_t misses_;
+                uint32_t invalidations_;
+
+                static bool is_ascii(char opcode) {
+                        return (opcode & 0x80) == 0;
+                }
+
+                void remove_opcode(char opcode);
+                void remove_expired(double now);
+
+        public:
+                ResponseCache();
+                ~ResponseCache() = default;
+
+                /** Sets the time-to-live of the responses of the
+                 * opcode, in seconds. A value of zero disables the
+                 * caching of the opcode. */
+                void set_ttl(char opcode, double seconds);
+                bool is_cached(char opcode) const;
+
+                /** Sending write_opcode removes the cached responses
+                 * of read_opcode. */
+                void link(char write_opcode, char read_opcode);
+                bool has_links(char opcode) const;
+
+                void set_capacity(size_t capacity);
+
+                /** Copies the cached response of the command into
+                 * response. Returns false if the command is not in
+                 * the cache or if its entry has expired. */
+                bool lookup(std::string_view command, Response& response, double now);
+
+                /** Stores a successful response. Other responses are
+                 * ignored. */
+                void store(std::string_view command, const Response& response,
+                           double now);
+
+                /** Removes the responses of the opcodes linked to
+                 * the given opcode. */
+                void invalidate_linked(char opcode);
+                void invalidate(char opcode);
+                void clear();
+
+                CacheStatistics get_statistics() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_RESPONSECACHE_H
@@ -0,0 +1,159 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <math.h>
+#include "RetryPolicy.h"
+#include "RomiSerialErrors.h"
+
+namespace romiserial {
+
+        RetryPolicy::RetryPolicy(uint8_t max_attempts)
+                : idempotent_()
+        {
+                set_max_attempts(max_attempts);
+        }
+
+        void RetryPolicy::set_max_attempts(uint8_t max_attempts)
+        {
+                for (int i = 0; i < 128; i++)
+                        max_attempts_[i] = max_attempts;
+        }
+
+        void RetryPolicy::set_max_attempts(char opcode, uint8_t max_attempts)
+        {
+                max_attempts_[(uint8_t) opcode & 0x7f] = max_attempts;
+        }
+
+        void RetryPolicy::set_idempotent(char opcode, bool value)
+        {
+                idempotent_[(uint8_t) opcode & 0x7f] = value;
+        }
+
+        bool RetryPolicy::is_envelope_error(int code)
+        {
+                return (code == kEnvelopeCrcMismatch
+                        || code == kEnvelopeInvalidId
+                        || code == kEnvelopeInvalidCrc
+                        || code == kEnvelopeExpectedEnd
+                        || code == kEnvelopeTooLong
+                        || code == kEnvelopeMissingMetadata);
+        }
+
+        double RetryPolicy::get_timeout_delay(int attempt)
+        {
+                (void) attempt;
+                return 0.0;
+        }
+
+        bool RetryPolicy::should_retry(char opcode, int attempt, int code,
+                                       double& delay)
+        {
+                uint8_t index = (uint8_t) opcode & 0x7f;
+                bool retry = false;
+                delay = 0.0;
+                if (attempt < max_attempts_[index]) {
+                        if (is_envelope_error(code)) {
+                                retry = true;
+                        } else if (code == kConnectionTimeout && idempotent_[index]) {
+                                // The firmware may have handled the
+                                // request and only the response was
+                                // lost, so only idempotent requests
+                                // are sent again.
+                                delay = get_timeout_delay(attempt);
+                                retry = true;
+                        }
+                }
+                return retry;
+        }
+
+        BackoffRetryPolicy::BackoffRetryPolicy(uint8_t max_attempts, double base,
+                                               double max, double jitter)
+                : RetryPolicy(max_attempts),
+                  base_(base),
+                  max_(max),
+                  jitter_(jitter),
+                  random_(std::random_device()())
+        {
+        }
+
+        double BackoffRetryPolicy::get_timeout_delay(int attempt)
+        {
+                double delay = ldexp(base_, (attempt > 16)? 15 : attempt - 1);
+                if (delay > max_)
+                        delay = max_;
+                std::uniform_real_distribution<double> distribution(0.0, jitter_);
+                return delay * (1.0 + distribution(random_));
+        }
+
+        RetryCounters::RetryCounters()
+                : requests_(0),
+                  attempts_(0),
+                  envelope_retries_(0),
+                  timeout_retries_(0),
+                  other_retries_(0),
+                  exhausted_(0)
+        {
+        }
+
+        void RetryCounters::count_request()
+        {
+                requests_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void RetryCounters::count_attempt()
+        {
+                attempts_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void RetryCounters::count_retry(int code)
+        {
+                if (RetryPolicy::is_envelope_error(code))
+                        envelope_retries_.fetch_add(1, std::memory_order_relaxed);
+                else if (code == kConnectionTimeout)
+                        timeout_retries_.fetch_add(1, std::memory_order_relaxed);
+                else
+                        other_retries_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void RetryCounters::count_exhausted()
+        {
+                exhausted_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        RetryStatistics RetryCounters::get() const
+        {
+                RetryStatistics stats;
+                stats.requests = requests_.load(std::memory_order_relaxed);
+                stats.attempts = attempts_.load(std::memory_order_relaxed);
+                stats.envelope_retries = envelope_retries_.load(std::memory_order_relaxed);
+                stats.timeout_retries = timeout_retries_.load(std::memory_order_relaxed);
+                stats.other_retries = other_retries_.load(std::memory_order_relaxed);
+                stats.exhausted = exhausted_.load(std::memory_order_relaxed);
+                return stats;
+        }
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_RETRYPOLICY_H
+#define __ROMISERIAL_RETRYPOLICY_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <atomic>
+#include <random>
+#include "IRetryPolicy.h"
+
+namespace romiserial {
+
+        static const uint8_t kDefaultMaxAttempts = 3;
+
+        /**
+         *  Re-sends a request immediately when the firmware reports
+         *  an error in the envelope (CRC mismatch, ...), up to a
+         *  maximum number of attempts that can be set per opcode.
+         *  The firmware did not handle such a request. A request
+         *  whose response timed out may have been handled, so it is
+         *  only sent again if its opcode was declared idempotent
+         *  with set_idempotent(). Application errors and other
+         *  errors are never retried.
+         */
+        class RetryPolicy : public IRetryPolicy
+        {
+        protected:
+                uint8_t max_attempts_[128];
+                bool idempotent_[128];
+
+                virtual double get_timeout_delay(int attempt);
+
+        public:
+                explicit RetryPolicy(uint8_t max_attempts = kDefaultMaxAttempts);
+                ~RetryPolicy() override = default;
+
+                void set_max_attempts(uint8_t max_attempts);
+                void set_max_attempts(char opcode, uint8_t max_attempts);
+
+                /** Allows re-sending requests of the opcode after a
+                 * timeout. Only for handlers that can safely run
+                 * twice, such as queries. */
+                void set_idempotent(char opcode, bool value = true);
+
+                bool should_retry(char opcode, int attempt, int code,
+                                  double& delay) override;
+
+                static bool is_envelope_error(int code);
+        };
+
+        /**
+         *  Like RetryPolicy, but waits before re-sending an
+         *  idempotent request that timed out. The delay doubles after each attempt,
+         *  starting at base and limited to max, and a random jitter
+         *  of up to the given fraction of the delay is added.
+         */
+        class BackoffRetryPolicy : public RetryPolicy
+        {
+        protected:
+                double base_;
+                double max_;
+                double jitter_;
+                std::minstd_rand random_;
+
+                double get_timeout_delay(int attempt) override;
+
+        public:
+                BackoffRetryPolicy(uint8_t max_attempts = kDefaultMaxAttempts,
+                                   double base = 0.010, double max = 0.200,
+                                   double jitter = 0.5);
+                ~BackoffRetryPolicy() override = default;
+        };
+
+        /** Counts the attempts made by a client. */
+        struct RetryStatistics
+        {
+                uint32_t requests;
+                uint32_t attempts;
+                uint32_t envelope_retries;
+                uint32_t timeout_retries;
+                uint32_t other_retries;
+                // Requests that still failed after the last attempt
+                // allowed by the policy.
+                uint32_t exhausted;
+        };
+
+        /** The counters behind RetryStatistics. They are updated by
+         * the I/O thread and can be read from any thread. */
+        class RetryCounters
+        {
+        protected:
+                std::atomic<uint32_t> requests_;
+                std::atomic<uint32_t> attempts_;
+                std::atomic<uint32_t> envelope_retries_;
+                std::atomic<uint32_t> timeout_retries_;
+                std::atomic<uint32_t> other_retries_;
+                std::atomic<uint32_t> exhausted_;
+
+        public:
+                RetryCounters();
+
+                void count_request();
+                void count_attempt();
+                void count_retry(int code);
+                void count_exhausted();
+                RetryStatistics get() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_RETRYPOLICY_H
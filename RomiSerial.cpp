@@ -27,6 +27,7 @@
 #include "RomiSerialErrors.h"
 #include "Printer.h"
 #include "RomiSerialUtil.h"
+#include "Tracer.h"
 #include <stdio.h>
 
 namespace romiserial {
@@ -39,7 +40,10 @@ namespace romiserial {
                   message_parser_(),
                   sent_response_(false),
                   crc_(),
-                  last_id_(255)
+                  last_id_(0xffff),
+                  push_sequence_(0),
+                  timestamps_(false),
+                  message_time_(0)
         {
         }
 
@@ -69,9 +73,13 @@ namespace romiserial {
         {
                 bool has_message = envelope_parser_.process(c);
                 if (has_message) {
+                        ROMISERIAL_TRACE_SCOPE("RomiSerial::message", "firmware",
+                                               "id", envelope_parser_.id());
                         process_message();
                 
                 } else if (envelope_parser_.error() != 0) {
+                        ROMISERIAL_TRACE_INSTANT("RomiSerial::envelope error", "firmware",
+                                                 "code", envelope_parser_.error());
                         send_error(envelope_parser_.error(), nullptr);
                 }
         }
@@ -109,11 +117,21 @@ namespace romiserial {
         {
                 int index = get_handler();
 
-                if (index < 0) {
+                if (message_parser_.opcode() == kIntrospectionOpcode) {
+                        handle_introspection();
+                        
+                } else if (message_parser_.opcode() == kHeartbeatOpcode) {
+                        send("[0]");
+                        
+                } else if (message_parser_.opcode() == kClockOpcode) {
+                        handle_clock();
+                        
+                } else if (index < 0) {
                         send_error(kUnknownOpcode, nullptr);
 
                 } else if (assert_valid_arguments(index)) {
                         sent_response_ = false;
+                        ROMISERIAL_TRACE_SCOPE("RomiSerial::handler", "firmware");
                         handlers_[index].callback(this,
                                                   message_parser_.values(),
                                                   message_parser_.string());
@@ -123,6 +141,51 @@ namespace romiserial {
                 }
         }
 
+        void RomiSerial::handle_introspection()
+        {
+                char reply[32];
+                
+                if (message_parser_.length() == 0) {
+                        snprintf(reply, sizeof(reply), "[0,%d,%d]",
+                                 (int) num_handlers_,
+                                 kFeaturePush | kFeatureLongId
+                                 | kFeatureHeartbeat | kFeatureTimestamp);
+                        send(reply);
+                        
+                } else if (message_parser_.length() == 1) {
+                        int index = message_parser_.value(0);
+                        if (index >= 0 && index < num_handlers_) {
+                                snprintf(reply, sizeof(reply), "[0,%d,%d,%d]",
+                                         (int) handlers_[index].opcode,
+                                         (int) handlers_[index].number_arguments,
+                                         handlers_[index].requires_string? 1 : 0);
+                                send(reply);
+                        } else {
+                                send_error(kValueOutOfRange, nullptr);
+                        }
+                        
+                } else {
+                        send_error(kBadNumberOfArguments, nullptr);
+                }
+        }
+
+        void RomiSerial::handle_clock()
+        {
+                if (message_parser_.length() > 1) {
+                        send_error(kBadNumberOfArguments, nullptr);
+                        
+                } else if (message_parser_.length() == 1
+                           && message_parser_.value(0) != 0
+                           && message_parser_.value(0) != 1) {
+                        send_error(kValueOutOfRange, nullptr);
+                        
+                } else {
+                        if (message_parser_.length() == 1)
+                                timestamps_ = (message_parser_.value(0) == 1);
+                        send(timestamps_? "[0,1]" : "[0,0]");
+                }
+        }
+
         int RomiSerial::get_handler()
         {
                 int index = -1;
@@ -188,6 +251,7 @@ namespace romiserial {
 
         void RomiSerial::start_message()
         {
+                message_time_ = timestamp_micros();
                 crc_.start();
                 append_char('#');
                 if (message_parser_.opcode()) 
@@ -200,6 +264,7 @@ namespace romiserial {
         {
                 append_start_metadata();
                 append_id();
+                append_timestamp();
                 append_crc();
                 append_char('\r');
                 append_char('\n');
@@ -230,6 +295,22 @@ namespace romiserial {
                 last_id_ = envelope_parser_.id();
         }
 
+        void RomiSerial::push(char topic, const char *message)
+        {
+                message_time_ = timestamp_micros();
+                crc_.start();
+                append_char('#');
+                append_char(kPushOpcode);
+                append_char(topic);
+                append_message(message);
+                append_start_metadata();
+                append_hex(push_sequence_++);
+                append_timestamp();
+                append_crc();
+                append_char('\r');
+                append_char('\n');
+        }
+
         void RomiSerial::send_message(const char *message)
         {
                 start_message();
@@ -245,7 +326,23 @@ namespace romiserial {
 
         void RomiSerial::append_id()
         {
-                append_hex(envelope_parser_.id());
+                // The response uses the ID format of the request.
+                uint16_t id = envelope_parser_.id();
+                if (envelope_parser_.has_long_id())
+                        append_hex((uint8_t) (id >> 8));
+                append_hex((uint8_t) id);
+        }
+
+        // The time at which the message was started.
+        void RomiSerial::append_timestamp()
+        {
+                if (timestamps_) {
+                        append_char('t');
+                        append_hex((uint8_t) (message_time_ >> 24));
+                        append_hex((uint8_t) (message_time_ >> 16));
+                        append_hex((uint8_t) (message_time_ >> 8));
+                        append_hex((uint8_t) message_time_);
+                }
         }
 
         void RomiSerial::append_crc()
@@ -255,6 +352,7 @@ namespace romiserial {
 
         void RomiSerial::log(const char *message)
         {
+                ROMISERIAL_TRACE_INSTANT("RomiSerial::log", "firmware");
                 Printer printer(out_);
                 printer.print("#!");
                 printer.print(message);
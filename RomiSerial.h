@@ -40,16 +40,22 @@ namespace romiserial {
                 IOutputStream& out_;
                 const MessageHandler *handlers_;
                 uint8_t num_handlers_;
-                EnvelopeParser envelope_parser_;
+                StaticEnvelopeParser<MAX_MESSAGE_LENGTH> envelope_parser_;
                 MessageParser message_parser_;
                 bool sent_response_;
                 CRC8 crc_;
-                uint8_t last_id_;
+                uint16_t last_id_;
+                uint8_t push_sequence_;
+                // Switched on by the host, see kClockOpcode.
+                bool timestamps_;
+                uint32_t message_time_;
         
                 void process_message();
                 void handle_char(char c);
                 void parse_and_handle_message();
                 void handle_message();
+                void handle_introspection();
+                void handle_clock();
                 int get_handler();
                 bool assert_valid_arguments(int index);
                 bool assert_valid_argument_count(int index);
@@ -77,6 +83,7 @@ namespace romiserial {
                 void send_ok() override;
                 void send_error(int code, const char *message) override;
                 void send(const char *message) override;
+                void push(char topic, const char *message) override;
                 void log(const char *message) override;
         
         protected:
@@ -84,6 +91,7 @@ namespace romiserial {
                 void append_hex(uint8_t value);
                 void append_start_metadata();
                 void append_id();
+                void append_timestamp();
                 void append_crc();
 
         };
@@ -28,12 +28,22 @@
 
 #include <string>
 #include <memory>
-#include <mutex>
+#include <span>
 #include <IRomiSerialClient.h>
+#include <ClientRequest.h>
+#include <Response.h>
+#include <RetryPolicy.h>
+#include <LaneStatistics.h>
+#include <ResponseCache.h>
+#include <Telemetry.h>
+#include <HandlerSchema.h>
+#include <LinkMetrics.h>
+#include <FirmwareLog.h>
+#include <LinkMonitor.h>
+#include <ClockEstimator.h>
 #include <IInputStream.h>
 #include <IOutputStream.h>
 #include <ILog.h>
-#include <EnvelopeParser.h>
 #include <RomiSerialErrors.h>
 
 namespace romiserial {
@@ -43,39 +53,39 @@ namespace romiserial {
                 kErrorMessage = 1
         };
 
-        // A 2.0 second timeout to read the response messages.
+        // The maximum time to wait for a response. The actual timeout
+        // is derived from the measured round-trip times of each
+        // opcode (see RttEstimator).
         static const double kRomiSerialClientTimeout = 2.0;
+        static const double kRomiSerialClientMinimumTimeout = 0.020;
+        // The longest time between two checks of the cancellation
+        // token of a request that is on the link, and of the
+        // deadlines and tokens of the queued requests.
+        static const double kRomiSerialClientCancelPoll = 0.005;
+        // The longest time a new request waits for the idle I/O
+        // thread when it is reading pushed frames.
+        static const double kRomiSerialClientIdlePoll = 0.002;
+        // The longest time load_handler_schema() waits for the
+        // firmware to answer the first introspection request.
+        static const double kRomiSerialClientProbeTimeout = 0.2;
         static const uint32_t kDefaultBaudRate = 115200;
+        // The size of the serial receive buffer of an Arduino Uno.
+        static const size_t kDefaultReceiveBufferSize = 64;
+        // The number of heartbeat periods without a frame after
+        // which the link is declared down.
+        static const int kDefaultMaxMissedHeartbeats = 3;
+        // The number of requests sent by enable_timestamps() to
+        // synchronize the clocks.
+        static const int kClockSyncRequests = 8;
+
+        class RomiSerialClientImpl;
 
-        using SynchronizedCodeBlock = std::lock_guard<std::mutex>;
-        
         class RomiSerialClient : public IRomiSerialClient
         {
         protected:
-                std::shared_ptr<IInputStream> in_;
-                std::shared_ptr<IOutputStream> out_;
-                std::shared_ptr<ILog> log_;
-                std::mutex mutex_;
-                uint8_t id_; 
-                bool debug_;
-                EnvelopeParser parser_;
-                nlohmann::json default_response_;
-                double timeout_;
-                const std::string client_name_;
-                
-                int make_request(const std::string &command, std::string &request);
-                nlohmann::json try_sending_request(std::string &request);
-                bool send_request(std::string &request);
-                nlohmann::json make_error(int code);
-                bool handle_one_char();
-                bool parse_char(int c);
-                nlohmann::json parse_response();
-                nlohmann::json read_response();
-                bool can_write();
-                bool filter_log_message();
-                nlohmann::json check_error_response(nlohmann::json& data);
-                nlohmann::json make_default_response();
-                std::string substitute_metachars(const std::string& command);
+                // The state and the I/O thread of the client, kept
+                // out of this header.
+                std::unique_ptr<RomiSerialClientImpl> impl_;
 
         public:
         
@@ -84,20 +94,226 @@ namespace romiserial {
                                const std::string& client_name,
                                std::shared_ptr<ILog> log);
                 
-                static uint8_t any_id();
+                /** A random start ID, so that a new client does not
+                 * match the responses of the previous one. */
+                static uint16_t any_id();
                 
                 explicit RomiSerialClient(std::shared_ptr<IInputStream> in,
                                           std::shared_ptr<IOutputStream> out,
                                           std::shared_ptr<ILog> log,
-                                          uint8_t start_id,
+                                          uint16_t start_id,
                                           const std::string& client_name);
                 RomiSerialClient(const RomiSerialClient&) = delete;
                 RomiSerialClient& operator=(const RomiSerialClient&) = delete;
                 ~RomiSerialClient() override;
 
-                uint8_t id();
+                uint16_t id();
+
+                /** Uses IDs with four hex digits instead of two, so
+                 * that a late response cannot match a newer request
+                 * with the same ID modulo 256. The firmware must
+                 * support it (kFeatureLongId). load_handler_schema()
+                 * enables them when it does. Must be called before
+                 * requests are submitted. */
+                void set_long_ids(bool value);
+                bool has_long_ids() const;
                 void send(const char *command, nlohmann::json& response) override;        
+
+                /** Sends a request without allocating memory. The
+                 * response holds the status code and the raw payload
+                 * returned by the firmware. The JSON array is only
+                 * built if Response::json() is called. */
+                void send(const char *command, Response& response,
+                          RequestPriority priority = kNormalPriority);
+
+                /** Sends a command built from a template. See
+                 * CommandTemplate. */
+                void send(const CommandTemplate& command,
+                          const int16_t *args, size_t count,
+                          Response& response);
+
+                /** Sends a typed command. The arguments must be
+                 * int16_t, int8_t, uint8_t, or a character array:
+                 *
+                 *   Response response = client.call<'V'>(left, right);
+                 *
+                 * The validity of the command is checked at compile
+                 * time, except for the characters of a string, which
+                 * yield kInvalidString. */
+                template <char Opcode, typename... Args>
+                Response call(const Args&... args) {
+                        ClientRequest request;
+                        request.set_command<Opcode>(args...);
+                        submit(request);
+                        request.wait();
+                        return request.response();
+                }
+
+                void submit(ClientRequest& request) override;
+
+                /** Sends several commands and waits for all the
+                 * responses. The frames are written back-to-back,
+                 * without waiting for the responses in between, as
+                 * long as the receive buffer of the firmware can hold
+                 * them (see set_receive_buffer_size()). The responses
+                 * are matched by ID. The batch stops at the first
+                 * frame that fails. That frame is sent again,
+                 * according to the retry policy, if the firmware has
+                 * not seen the frames after it, and the batch then
+                 * resumes. The frames that were not sent get
+                 * kBatchAborted. Each command gets its own response
+                 * and error code. Only the first
+                 * min(commands.size(), responses.size()) commands are
+                 * sent. */
+                void send_batch(std::span<const char * const> commands,
+                                std::span<Response> responses);
+
+                /** Submits several requests as one batch without
+                 * waiting. See send_batch(). */
+                void submit_batch(std::span<ClientRequest> requests);
+
+                /** The number of bytes the firmware can buffer while
+                 * it is handling a request. Must be called before
+                 * requests are submitted. */
+                void set_receive_buffer_size(size_t bytes);
+
+                /** Registers a callback for the frames that the
+                 * firmware pushes on the given topic (see
+                 * IRomiSerial::push()). The callback is called by the
+                 * I/O thread and should return quickly. It may
+                 * subscribe or unsubscribe. */
+                void subscribe(char topic, TelemetryCallback callback);
+
+                /** Registers a queue for the frames of the
+                 * topic. Samples that find the queue full are
+                 * dropped and counted. */
+                void subscribe(char topic, std::shared_ptr<TelemetryQueue> queue);
+                
+                void unsubscribe(char topic);
+
+                TelemetryStatistics get_telemetry_statistics() const;
+
+                /** Downloads the handler table of the firmware. From
+                 * then on, requests with an unknown opcode, a wrong
+                 * number of arguments, or a missing or unexpected
+                 * string fail locally with the error code the
+                 * firmware would have returned. Returns false if the
+                 * firmware does not support introspection, in which
+                 * case no validation is done and, unlike other
+                 * failures, no warning is logged. The first request
+                 * gives up after kRomiSerialClientProbeTimeout.
+                 * create() calls this function. It should not be
+                 * called while other threads submit requests. */
+                bool load_handler_schema();
+
+                /** The description of the handler of the opcode, if
+                 * the handler table was loaded. */
+                bool get_handler_info(char opcode, HandlerInfo& info) const;
+
+                /** The feature bits of the firmware, such as
+                 * kFeaturePush. Zero if the handler table was not
+                 * loaded. */
+                int get_firmware_features() const;
+
+                /** The number of log frames received from the
+                 * firmware, and of those that were dropped because
+                 * the log could not keep up. */
+                FirmwareLogStatistics get_firmware_log_statistics() const;
+
+                /** A snapshot of the link counters and of the
+                 * per-opcode counters and latency histograms. */
+                LinkMetricsSnapshot get_metrics() const;
+
+                /** Sends a heartbeat whenever the firmware has been
+                 * silent for the given period, in seconds. The link
+                 * is declared down when no frame arrives during
+                 * max_missed periods, plus the budget of the handler
+                 * of the request on the link, if one was declared
+                 * (see set_timeout_budget()). The request on the
+                 * link, and the queued and new requests, then fail
+                 * at once with kLinkDown, until the firmware is heard
+                 * again. */
+                void start_heartbeat(double period,
+                                     int max_missed = kDefaultMaxMissedHeartbeats);
+                void stop_heartbeat();
+
+                /** False when the heartbeat declared the link
+                 * down. Always true without heartbeat. */
+                bool is_link_up() const;
+                LinkHealth get_link_health() const;
+
+                /** Asks the firmware to add its micros() to the
+                 * responses and pushed frames (kFeatureTimestamp),
+                 * and sends a few requests to synchronize the
+                 * clocks. From then on, every timestamped response
+                 * updates the clock estimate, and the pushed frames
+                 * get a sample_time. Returns false if the firmware
+                 * does not support timestamps. */
+                bool enable_timestamps(bool value = true);
+
+                /** Converts a timestamp of the firmware, see
+                 * Response::timestamp(), to the monotonic clock of
+                 * the host (see rmonotonic()). The error is a bound
+                 * on the error of the conversion, in seconds. Returns
+                 * false when the clocks are not synchronized. */
+                bool to_host_time(uint32_t micros, double& time, double& error) const;
+
+                ClockEstimate get_clock_estimate() const;
+
                 void set_debug(bool value) override;
+
+                /** Sets the lower and upper limits of the response
+                 * timeout. Must be called before requests are
+                 * submitted. */
+                void set_timeout_limits(double floor, double ceiling);
+
+                /** Declares that the handler of the opcode may take
+                 * up to the given time to respond. Must be called
+                 * before requests are submitted. */
+                void set_timeout_budget(char opcode, double seconds);
+
+                /** The current response timeout for the opcode. */
+                double get_timeout(char opcode);
+
+                /** Sets the policy that decides when failed requests
+                 * are sent again. The default is a
+                 * BackoffRetryPolicy without idempotent opcodes, so
+                 * requests that timed out are not sent again. Must
+                 * be called before requests are submitted. */
+                void set_retry_policy(std::shared_ptr<IRetryPolicy> policy);
+
+                RetryStatistics get_retry_statistics() const;
+
+                LaneStatistics get_lane_statistics(RequestPriority priority) const;
+
+                /** Marks the opcode as idempotent and read-only. A
+                 * request for this opcode that is identical to one
+                 * already submitted, with the same priority, is not
+                 * sent again but receives a copy of the response of
+                 * the earlier request. Must be called before requests
+                 * are submitted. */
+                void set_read_only(char opcode, bool value = true);
+
+                /** The number of requests that were answered by the
+                 * response of an identical request. */
+                uint32_t get_coalesced_requests() const;
+
+                /** Caches the successful responses of the opcode for
+                 * the given time, in seconds. The cache is keyed by
+                 * the full command. A value of zero disables caching
+                 * for the opcode. Must be called before requests are
+                 * submitted. */
+                void set_cache_ttl(char opcode, double seconds);
+
+                /** Sending write_opcode removes the cached responses
+                 * of read_opcode. Must be called before requests are
+                 * submitted. */
+                void set_cache_invalidation(char write_opcode, char read_opcode);
+
+                void invalidate_cache(char opcode);
+                void invalidate_cache();
+                
+                CacheStatistics get_cache_statistics() const;
         
                 static const char *get_error_message(int code);        
         };
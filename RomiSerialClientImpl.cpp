@@ -0,0 +1,1518 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#include <chrono>
+
+#include "json.hpp"
+#include "CRC8.h"
+#include "RomiSerialClientImpl.h"
+#include "RomiSerialErrors.h"
+#include "RomiSerialUtil.h"
+#include "Tracer.h"
+
+#include "rtime.h"
+
+using namespace std;
+
+namespace romiserial {
+
+        RomiSerialClientImpl::RomiSerialClientImpl(std::shared_ptr<IInputStream> in,
+                                                   std::shared_ptr<IOutputStream> out,
+                                                   std::shared_ptr<ILog> log,
+                                                   uint16_t start_id,
+                                                   const std::string& client_name)
+                :   in_(in),
+                    out_(out),
+                    log_(log),
+                    id_((uint16_t) (start_id & 0xff)),
+                    start_id_(start_id),
+                    long_ids_(false),
+                    abandoned_(),
+                    debug_(false),
+                    parser_(),
+                    rtt_(),
+                    retry_policy_(std::make_shared<BackoffRetryPolicy>()),
+                    retry_counters_(),
+                    client_name_(client_name),
+                    queues_(),
+                    lane_counters_(),
+                    backlog_head_(),
+                    backlog_tail_(),
+                    next_expiry_check_(0.0),
+                    read_only_(),
+                    in_flight_mutex_(),
+                    in_flight_(nullptr),
+                    coalesced_requests_(0),
+                    cache_(),
+                    receive_buffer_size_(kDefaultReceiveBufferSize),
+                    batch_buffer_(),
+                    telemetry_(),
+                    schema_(),
+                    metrics_(),
+                    firmware_log_(log, client_name),
+                    link_(),
+                    heartbeat_mutex_(),
+                    heartbeat_condition_(),
+                    heartbeat_quit_(false),
+                    heartbeat_thread_(),
+                    clock_(),
+                    signal_(0),
+                    quit_(false),
+                    thread_()
+        {
+                in->set_timeout(0.1f);
+                rtt_.set_limits(kRomiSerialClientMinimumTimeout,
+                                kRomiSerialClientTimeout);
+                thread_ = std::thread(&RomiSerialClientImpl::run, this);
+        }
+
+        RomiSerialClientImpl::~RomiSerialClientImpl()
+        {
+                stop_heartbeat();
+                quit_.store(true, std::memory_order_release);
+                wake_up();
+                if (thread_.joinable())
+                        thread_.join();
+        }
+
+        void RomiSerialClientImpl::wake_up()
+        {
+                signal_.fetch_add(1, std::memory_order_release);
+                signal_.notify_one();
+        }
+
+        void RomiSerialClientImpl::submit(ClientRequest& request)
+        {
+                request.set_pending(rtime());
+
+                int err = validate(request);
+                if (err != 0) {
+                        set_error(request.response(), err);
+                        request.complete();
+                        return;
+                }
+                
+                if (is_cut_off(request)) {
+                        set_error(request.response(), kLinkDown);
+                        request.complete();
+                        return;
+                }
+                
+                if (lookup_cache(request)) {
+                        request.complete();
+                        return;
+                }
+                if (can_coalesce(request) && join_in_flight(request))
+                        return;
+                queues_[request.priority()].push(&request);
+                wake_up();
+        }
+
+        int RomiSerialClientImpl::validate(const ClientRequest& request) const
+        {
+                int err = request.error();
+                if (err == 0) {
+                        std::string_view command = request.command();
+                        err = schema_.validate(command.data(), command.size());
+                }
+                return err;
+        }
+
+        // Once the link is declared down, only the heartbeats are
+        // sent. The request must have passed validate().
+        bool RomiSerialClientImpl::is_cut_off(const ClientRequest& request)
+        {
+                bool cut_off = (link_.is_down()
+                                && *request.encoder().message() != kHeartbeatOpcode);
+                if (cut_off)
+                        link_.count_rejected_request();
+                return cut_off;
+        }
+
+        // Requests with a deadline or a cancellation token are
+        // always sent on their own.
+        bool RomiSerialClientImpl::can_coalesce(const ClientRequest& request) const
+        {
+                char opcode = *request.encoder().message();
+                return (request.error() == 0
+                        && !request.has_deadline()
+                        && !request.is_cancellable()
+                        && (opcode & 0x80) == 0
+                        && read_only_[(int) opcode].load(std::memory_order_relaxed));
+        }
+
+        bool RomiSerialClientImpl::join_in_flight(ClientRequest& request)
+        {
+                std::lock_guard<std::mutex> lock(in_flight_mutex_);
+
+                for (ClientRequest *r = in_flight_; r != nullptr; r = r->next_in_flight()) {
+                        if (r->priority() == request.priority()
+                            && r->has_same_command(request)) {
+                                r->add_follower(&request);
+                                coalesced_requests_.fetch_add(1, std::memory_order_relaxed);
+                                return true;
+                        }
+                }
+
+                request.set_coalesced(true);
+                request.set_next_in_flight(in_flight_);
+                in_flight_ = &request;
+                return false;
+        }
+
+        void RomiSerialClientImpl::complete_in_flight(ClientRequest& request)
+        {
+                ClientRequest *followers;
+                {
+                        std::lock_guard<std::mutex> lock(in_flight_mutex_);
+                        ClientRequest *previous = nullptr;
+                        ClientRequest *r = in_flight_;
+                        while (r != &request) {
+                                previous = r;
+                                r = r->next_in_flight();
+                        }
+                        if (previous == nullptr)
+                                in_flight_ = request.next_in_flight();
+                        else
+                                previous->set_next_in_flight(request.next_in_flight());
+                        followers = request.followers();
+                }
+
+                // The followers may be released as soon as they are
+                // completed, so the next one is fetched first.
+                while (followers != nullptr) {
+                        ClientRequest *next = followers->next_follower();
+                        followers->response() = request.response();
+                        followers->complete();
+                        followers = next;
+                }
+        }
+
+        bool RomiSerialClientImpl::lookup_cache(ClientRequest& request)
+        {
+                if (request.error() != 0)
+                        return false;
+                
+                char opcode = *request.encoder().message();
+                if (cache_.has_links(opcode))
+                        cache_.invalidate_linked(opcode);
+                
+                return (cache_.is_cached(opcode)
+                        && cache_.lookup(request.command(), request.response(),
+                                         request.submit_time()));
+        }
+
+        void RomiSerialClientImpl::update_cache(ClientRequest& request)
+        {
+                char opcode = *request.encoder().message();
+                if (cache_.has_links(opcode)) {
+                        // Drop the responses that were cached while
+                        // the request was on the link.
+                        cache_.invalidate_linked(opcode);
+                }
+                if (cache_.is_cached(opcode))
+                        cache_.store(request.command(), request.response(), rtime());
+        }
+
+        void RomiSerialClientImpl::run()
+        {
+                Tracer::set_thread_name("RomiSerialClient<" + client_name_ + ">");
+                
+                while (true) {
+                        uint32_t signal = signal_.load(std::memory_order_acquire);
+                        bool handled = handle_pending_requests();
+                        // Pending requests are completed before the
+                        // thread quits.
+                        if (!handled && quit_.load(std::memory_order_acquire))
+                                break;
+                        if (!handled) {
+                                if (telemetry_.has_subscribers())
+                                        read_pushed_frames(signal);
+                                else
+                                        signal_.wait(signal, std::memory_order_acquire);
+                        }
+                }
+        }
+
+        /* The firmware may push frames at any time. While there are
+         * subscribers, the idle I/O thread keeps reading the input,
+         * checking for new requests after each poll. */
+        void RomiSerialClientImpl::read_pushed_frames(uint32_t signal)
+        {
+                in_->set_timeout(kRomiSerialClientIdlePoll);
+                
+                while (signal_.load(std::memory_order_acquire) == signal
+                       && telemetry_.has_subscribers()) {
+                        if (in_->available()
+                            && handle_one_char()
+                            && filter_log_message()
+                            && filter_pushed_frame()) {
+                                log_->warn("RomiSerialClient<%s>: "
+                                           "unexpected response: '%s'",
+                                           client_name_.c_str(),
+                                           parser_.message());
+                        }
+                }
+        }
+
+        ClientRequest *RomiSerialClientImpl::next_request()
+        {
+                ClientRequest *request = pop_request(kHighPriority);
+                if (request == nullptr)
+                        request = pop_request(kNormalPriority);
+                return request;
+        }
+
+        ClientRequest *RomiSerialClientImpl::pop_request(RequestPriority priority)
+        {
+                ClientRequest *request = backlog_head_[priority];
+                if (request != nullptr) {
+                        backlog_head_[priority] = request->next_queued();
+                        if (backlog_head_[priority] == nullptr)
+                                backlog_tail_[priority] = nullptr;
+                } else {
+                        request = queues_[priority].pop();
+                }
+                return request;
+        }
+
+        /* Called by the I/O thread while it is busy with another
+         * request, so that the callers of the requests that are
+         * cancelled or past their deadline do not wait for the
+         * requests ahead of them. */
+        void RomiSerialClientImpl::expire_queued_requests()
+        {
+                double now = rtime();
+                if (now < next_expiry_check_)
+                        return;
+                next_expiry_check_ = now + kRomiSerialClientCancelPoll;
+                
+                for (int lane = 0; lane < kNumberOfPriorities; lane++) {
+                        ClientRequest *request;
+                        while ((request = queues_[lane].pop()) != nullptr) {
+                                request->set_next_queued(nullptr);
+                                if (backlog_tail_[lane] == nullptr)
+                                        backlog_head_[lane] = request;
+                                else
+                                        backlog_tail_[lane]->set_next_queued(request);
+                                backlog_tail_[lane] = request;
+                        }
+
+                        ClientRequest *previous = nullptr;
+                        request = backlog_head_[lane];
+                        while (request != nullptr) {
+                                ClientRequest *next = request->next_queued();
+                                int code = kNoError;
+                                // Batches check their requests one
+                                // by one, see handle_batch().
+                                if (request->batch_size() == 0) {
+                                        if (request->is_cancelled())
+                                                code = kRequestCancelled;
+                                        else if (request->has_expired(now))
+                                                code = kDeadlineExceeded;
+                                        else if (is_cut_off(*request))
+                                                code = kLinkDown;
+                                }
+                                
+                                if (code == kNoError) {
+                                        previous = request;
+                                } else {
+                                        if (previous == nullptr)
+                                                backlog_head_[lane] = next;
+                                        else
+                                                previous->set_next_queued(next);
+                                        if (backlog_tail_[lane] == request)
+                                                backlog_tail_[lane] = previous;
+                                        
+                                        request->set_started(now);
+                                        set_error(request->response(), code);
+                                        lane_counters_[lane].record(now - request->submit_time(),
+                                                                    0.0);
+                                        request->complete();
+                                }
+                                request = next;
+                        }
+                }
+        }
+
+        /* Sleeps before a retry without delaying the expiry of the
+         * queued requests. */
+        void RomiSerialClientImpl::pause(double delay)
+        {
+                double end = rtime() + delay;
+                double remaining;
+                while ((remaining = end - rtime()) > 0.0) {
+                        rsleep(std::min(remaining, kRomiSerialClientCancelPoll));
+                        expire_queued_requests();
+                }
+        }
+
+        bool RomiSerialClientImpl::handle_pending_requests()
+        {
+                bool handled = false;
+                ClientRequest *request;
+                // The high-priority queue is checked again after
+                // each request.
+                while ((request = next_request()) != nullptr) {
+                        if (request->batch_size() > 0)
+                                handle_batch(request, request->batch_size());
+                        else
+                                handle_request(*request);
+                        handled = true;
+                }
+                return handled;
+        }
+
+        void RomiSerialClientImpl::handle_request(ClientRequest& request)
+        {
+                Response& response = request.response();
+
+                request.set_started(rtime());
+
+                if (request.error() != 0) {
+                        set_error(response, request.error());
+                } else if (request.is_cancelled()) {
+                        set_error(response, kRequestCancelled);
+                } else if (request.has_expired(request.start_time())) {
+                        set_error(response, kDeadlineExceeded);
+                } else if (is_cut_off(request)) {
+                        set_error(response, kLinkDown);
+                } else {
+                        next_id();
+                        ROMISERIAL_TRACE_SCOPE("request", "client", "id", id_);
+                        request.encoder().finalize(id_, long_ids_);
+                        retry_counters_.count_request();
+                        metrics_.count_request(*request.encoder().message());
+                        try_sending_request(request);
+                        update_cache(request);
+                }
+
+                double now = rtime();
+                lane_counters_[request.priority()].record(request.start_time()
+                                                          - request.submit_time(),
+                                                          now - request.start_time());
+                if (request.is_coalesced())
+                        complete_in_flight(request);
+                request.complete();
+        }
+
+        void RomiSerialClientImpl::try_sending_request(ClientRequest& request,
+                                                       int first_attempt)
+        {
+                EnvelopeEncoder& encoder = request.encoder();
+                Response& response = request.response();
+                char opcode = *encoder.message();
+
+                response.set_error(kConnectionTimeout);
+                double request_time = rtime();
+
+                if (debug_) {
+                        log_->debug("RomiSerialClient<%s>::try_sending_request: %.*s",
+                                    client_name_.c_str(),
+                                    (int) encoder.length(), encoder.data());
+                }
+        
+                for (int attempt = first_attempt; ; attempt++) {
+                        
+                        retry_counters_.count_attempt();
+                        double sent = rmonotonic();
+                        
+                        if (send_request(encoder)) {
+
+                                double start_time = rtime();
+                                double timeout = rtt_.timeout(opcode);
+                                if (request.has_deadline())
+                                        timeout = std::min(timeout,
+                                                           request.deadline() - start_time);
+                                
+                                bool matched = read_response(request, timeout);
+
+                                // Only measure requests that were sent
+                                // once (Karn's algorithm).
+                                if (matched && attempt == 1) {
+                                        rtt_.update(opcode, rtime() - start_time);
+                                        if (response.has_timestamp())
+                                                clock_.add_sample(sent, rmonotonic(),
+                                                                  response.timestamp());
+                                } else if (response.status() == kConnectionTimeout)
+                                        rtt_.backoff(opcode);
+
+                                // CRC errors are detected on either
+                                // side of the link.
+                                if (response.status() == kConnectionTimeout)
+                                        metrics_.count_timeout(opcode);
+                                else if (response.status() == kEnvelopeCrcMismatch)
+                                        metrics_.count_crc_error(opcode);
+                        } else {
+                                set_error(response, kConnectionTimeout);
+                        }
+
+                        /* The retry policy decides whether the
+                         * request should be sent again, for example
+                         * when the error relates to the message
+                         * envelope. Duplicate messages are
+                         * intercepted by the firmware, in which case
+                         * the kDuplicate error code is returned.  */
+                        int code = response.status();
+                        double delay = 0.0;
+                        
+                        if (code == kNoError
+                            || code == kRequestCancelled
+                            || code == kDeadlineExceeded
+                            || code == kLinkDown
+                            || !retry_policy_->should_retry(opcode, attempt, code, delay)) {
+                                if (RetryPolicy::is_envelope_error(code)
+                                    || code == kConnectionTimeout)
+                                        retry_counters_.count_exhausted();
+                                break;
+                        }
+
+                        retry_counters_.count_retry(code);
+                        metrics_.count_retry(opcode);
+                        ROMISERIAL_TRACE_INSTANT("retry", "client", "status", code);
+                        
+                        if (debug_) {
+                                log_->debug("RomiSerialClient<%s>::"
+                                            "try_sending_request: "
+                                            "re-sending request after %.3f s: %.*s",
+                                            client_name_.c_str(), delay,
+                                            (int) encoder.length(),
+                                            encoder.data());
+                        }
+
+                        if (request.has_expired(rtime() + delay)) {
+                                set_error(response, kDeadlineExceeded);
+                                break;
+                        }
+                        
+                        if (delay > 0.0)
+                                pause(delay);
+
+                        if (request.is_cancelled()) {
+                                set_error(response, kRequestCancelled);
+                                break;
+                        }
+
+                        if (is_cut_off(request)) {
+                                set_error(response, kLinkDown);
+                                break;
+                        }
+                }
+
+                // The latency of the requests that were answered by
+                // the firmware, retries included.
+                int status = response.status();
+                if (status != kConnectionTimeout
+                    && status != kRequestCancelled
+                    && status != kDeadlineExceeded
+                    && status != kLinkDown)
+                        metrics_.record_latency(opcode, rtime() - request_time);
+        }
+
+        bool RomiSerialClientImpl::send_request(EnvelopeEncoder& request)
+        {
+                ROMISERIAL_TRACE_SCOPE("write", "client", "bytes",
+                                       (int64_t) request.length());
+                metrics_.count_bytes_out(request.length());
+                return out_->write(request.data(), request.length());
+        }
+
+        void RomiSerialClientImpl::handle_batch(ClientRequest *requests, size_t count)
+        {
+                std::vector<ClientRequest*> frames;
+                double now = rtime();
+
+                ROMISERIAL_TRACE_SCOPE("batch", "client", "size", (int64_t) count);
+                frames.reserve(count);
+                
+                for (size_t i = 0; i < count; i++) {
+                        ClientRequest& request = requests[i];
+                        Response& response = request.response();
+                        
+                        request.set_started(now);
+
+                        int err = validate(request);
+                        if (err != 0) {
+                                set_error(response, err);
+                        } else if (request.is_cancelled()) {
+                                set_error(response, kRequestCancelled);
+                        } else if (request.has_expired(now)) {
+                                set_error(response, kDeadlineExceeded);
+                        } else if (is_cut_off(request)) {
+                                set_error(response, kLinkDown);
+                        } else {
+                                // The frames get consecutive IDs.
+                                next_id();
+                                request.encoder().finalize(id_, long_ids_);
+                                response.set_error(kConnectionTimeout);
+                                retry_counters_.count_request();
+                                metrics_.count_request(*request.encoder().message());
+                                frames.push_back(&request);
+                        }
+                }
+
+                // The firmware handles the frames in order. When a
+                // frame fails, the batch stops there and the frame is
+                // retried before the next frames are sent.
+                size_t start = 0;
+                while (start < frames.size()) {
+                        size_t failed = pipeline_batch(frames, start);
+                        if (failed == frames.size()
+                            || !resend_if_failed(frames, failed))
+                                break;
+                        start = failed + 1;
+                        for (size_t i = start; i < frames.size(); i++) {
+                                next_id();
+                                frames[i]->encoder().finalize(id_, long_ids_);
+                                frames[i]->response().set_error(kConnectionTimeout);
+                        }
+                }
+
+                now = rtime();
+                for (size_t i = 0; i < count; i++) {
+                        ClientRequest& request = requests[i];
+                        lane_counters_[request.priority()].record(request.start_time()
+                                                                  - request.submit_time(),
+                                                                  now - request.start_time());
+                        request.complete();
+                }
+        }
+
+        size_t RomiSerialClientImpl::pipeline_batch(std::vector<ClientRequest*>& frames,
+                                                    size_t start)
+        {
+                size_t count = frames.size();
+                uint16_t mask = id_mask();
+                uint16_t first_id = (uint16_t) ((id_ - (count - 1)) & mask);
+                size_t next_send = start;
+                size_t next_ack = start;
+                size_t in_flight = 0;
+                size_t failed = count;
+                Response response;
+                std::vector<double> sent_at(count);
+
+                batch_buffer_.resize(std::max(receive_buffer_size_,
+                                              (size_t) MAX_ENVELOPE_LENGTH));
+
+                // A frame fails when it was lost or corrupted. After
+                // a failed frame, no new frames are written but the
+                // frames in flight are still collected.
+                while (next_ack < next_send
+                       || (failed == count && next_send < count)) {
+
+                        if (link_.is_down()) {
+                                for (size_t i = next_ack; i < count; i++) {
+                                        frames[i]->response().set_error(kLinkDown);
+                                        abandoned_.set((first_id + i) & mask);
+                                }
+                                return std::min(failed, next_ack);
+                        }
+
+                        // Write as many frames as the receive buffer
+                        // of the firmware can hold. There is always
+                        // at least one frame in flight.
+                        size_t length = 0;
+                        while (failed == count && next_send < count) {
+                                const EnvelopeEncoder& encoder = frames[next_send]->encoder();
+                                if (next_send > next_ack
+                                    && in_flight + encoder.length() > receive_buffer_size_)
+                                        break;
+                                memcpy(batch_buffer_.data() + length,
+                                       encoder.data(), encoder.length());
+                                length += encoder.length();
+                                in_flight += encoder.length();
+                                sent_at[next_send] = rtime();
+                                next_send++;
+                                retry_counters_.count_attempt();
+                        }
+
+                        metrics_.count_bytes_out(length);
+                        if (length > 0 && !write_batch(length)) {
+                                // The remaining requests keep the
+                                // kConnectionTimeout status.
+                                for (size_t i = next_ack; i < count; i++)
+                                        abandoned_.set((first_id + i) & mask);
+                                return std::min(failed, next_ack);
+                        }
+
+                        // Wait for the response of the oldest frame
+                        // in flight.
+                        char opcode = *frames[next_ack]->encoder().message();
+                        link_.allow_silence(rtime() + rtt_.budget(opcode));
+                        int id = read_any_response(response, rtt_.timeout(opcode));
+                        size_t index;
+                        
+                        if (id == -3) {
+                                // The frames are failed at the top of
+                                // the loop.
+                                continue;
+                                
+                        } else if (id == -1) {
+                                // Consider the frame lost.
+                                rtt_.backoff(opcode);
+                                metrics_.count_timeout(opcode);
+                                index = next_ack;
+                                
+                        } else if (id >= 0 && (abandoned_.test((size_t) id)
+                                               || response.status() == kDuplicate)) {
+                                // A late response.
+                                metrics_.count_id_mismatch(opcode);
+                                continue;
+                                
+                        } else {
+                                if (response.status() == kEnvelopeCrcMismatch)
+                                        metrics_.count_crc_error(opcode);
+                                
+                                size_t offset = (size_t) (id - (int) (first_id + next_ack)) & mask;
+                                if (id >= 0 && offset < next_send - next_ack) {
+                                        index = next_ack + offset;
+                                } else if (id < 0 || response.status() != 0) {
+                                        // An error that cannot be
+                                        // matched by its ID is
+                                        // assigned to the oldest frame.
+                                        index = next_ack;
+                                } else {
+                                        log_->warn("RomiSerialClient<%s>: "
+                                                   "unexpected ID in batch: %d",
+                                                   client_name_.c_str(), id);
+                                        metrics_.count_id_mismatch(opcode);
+                                        continue;
+                                }
+                                frames[index]->response() = response;
+                                if (id >= 0)
+                                        metrics_.record_latency(*frames[index]->encoder().message(),
+                                                                rtime() - sent_at[index]);
+                        }
+
+                        // The firmware handles the frames in order,
+                        // so the frames before this one were lost.
+                        for (size_t i = next_ack; i <= index; i++) {
+                                in_flight -= frames[i]->encoder().length();
+                                if (frames[i]->response().status() == kConnectionTimeout)
+                                        abandoned_.set((first_id + i) & mask);
+                                int status = frames[i]->response().status();
+                                if (failed == count
+                                    && (status == kConnectionTimeout
+                                        || RetryPolicy::is_envelope_error(status)))
+                                        failed = i;
+                        }
+                        next_ack = index + 1;
+                }
+
+                for (size_t i = next_send; i < count; i++)
+                        frames[i]->response().set_error(kBatchAborted);
+                
+                return failed;
+        }
+
+        bool RomiSerialClientImpl::resend_if_failed(std::vector<ClientRequest*>& frames,
+                                                    size_t failed)
+        {
+                ClientRequest& request = *frames[failed];
+                char opcode = *request.encoder().message();
+                int code = request.response().status();
+                double delay = 0.0;
+
+                // The firmware may already have handled the frames
+                // that followed the failed one. Sending it again
+                // would change the order of the side effects.
+                for (size_t i = failed + 1; i < frames.size(); i++) {
+                        if (frames[i]->response().status() != kBatchAborted)
+                                return false;
+                }
+                
+                if (code == kLinkDown
+                    || !retry_policy_->should_retry(opcode, 1, code, delay))
+                        return false;
+                
+                retry_counters_.count_retry(code);
+                metrics_.count_retry(opcode);
+                ROMISERIAL_TRACE_INSTANT("retry", "client", "status", code);
+                if (delay > 0.0)
+                        pause(delay);
+                next_id();
+                request.encoder().finalize(id_, long_ids_);
+                try_sending_request(request, 2);
+                return request.response().status() == kNoError;
+        }
+
+        bool RomiSerialClientImpl::write_batch(size_t length)
+        {
+                ROMISERIAL_TRACE_SCOPE("write", "client", "bytes", (int64_t) length);
+                return out_->write(batch_buffer_.data(), length);
+        }
+
+        /* Returns the ID of the response, -1 when no response arrived
+         * in time, -2 when the response was corrupted, or -3 when the
+         * link was declared down. */
+        int RomiSerialClientImpl::read_any_response(Response& response, double timeout)
+        {
+                in_->set_timeout((float) std::clamp(timeout / 4.0, 0.001,
+                                                    kRomiSerialClientCancelPoll));
+                
+                ROMISERIAL_TRACE_SCOPE("read response", "client");
+                double start_time = rtime();
+                bool first_byte = true;
+                
+                while (rtime() - start_time <= timeout) {
+                        expire_queued_requests();
+                        if (link_.is_down()) {
+                                set_error(response, kLinkDown);
+                                return -3;
+                        }
+                        if (in_->available()) {
+                                trace_first_byte(first_byte);
+                                bool has_message = handle_one_char();
+                                if (has_message) 
+                                        has_message = filter_log_message();
+                                if (has_message)
+                                        has_message = filter_pushed_frame();
+                                if (has_message) {
+                                        if (debug_) {
+                                                log_->debug("RomiSerialClient<%s>::"
+                                                            "read_any_response: %s",
+                                                            client_name_.c_str(),
+                                                            parser_.message());
+                                        }
+                                        parse_response(response);
+                                        return parser_.id();
+                                        
+                                } else if (parser_.error() != 0 && !is_pushed_frame()) {
+                                        // A corrupted pushed frame is
+                                        // detected by its sequence
+                                        // number instead.
+                                        log_->warn("RomiSerialClient<%s>: "
+                                                   "invalid response: '%s'",
+                                                   client_name_.c_str(),
+                                                   parser_.message());
+                                        set_error(response, parser_.error());
+                                        return -2;
+                                }
+                        }
+                }
+                
+                set_error(response, kConnectionTimeout);
+                return -1;
+        }
+
+        void RomiSerialClientImpl::set_error(Response& response, int code)
+        {
+                if (debug_) {
+                        log_->debug("RomiSerialClient<%s>::set_error: %d, %s",
+                                    client_name_.c_str(), code,
+                                    get_error_message(code));
+                }
+                response.set_error(code);
+        }
+
+        bool RomiSerialClientImpl::parse_char(int c)
+        {
+                return parser_.process((char) c);
+        }
+
+        void RomiSerialClientImpl::trace_first_byte(bool& first_byte)
+        {
+                if (first_byte) {
+                        ROMISERIAL_TRACE_INSTANT("first byte", "client");
+                        first_byte = false;
+                }
+        }
+
+        void RomiSerialClientImpl::parse_response(Response& response)
+        {
+                ROMISERIAL_TRACE_SCOPE("parse response", "client");
+                // The message starts with the opcode, followed by
+                // the payload, and is terminated by a zero.
+                if (parser_.length() > 2) {
+                
+                        size_t length = (size_t) (parser_.length() - 2);
+                        if (!response.set_payload(parser_.message_content(), length)) {
+                                log_->warn("RomiSerialClient<%s>::parse_response: "
+                                           "invalid response: '%s'",
+                                           client_name_.c_str(),
+                                           parser_.message());
+                                set_error(response, kInvalidResponse);
+                        } else if (parser_.has_timestamp()) {
+                                response.set_timestamp(parser_.timestamp());
+                        }
+                
+                } else {
+                        log_->warn("RomiSerialClient<%s>::parse_response: "
+                                   "invalid response: no values: '%s'",
+                                   client_name_.c_str(), parser_.message());
+                        set_error(response, kEmptyResponse);
+                }
+        }
+
+        bool RomiSerialClientImpl::is_pushed_frame()
+        {
+                return parser_.length() > 0 && parser_.message()[0] == kPushOpcode;
+        }
+
+        bool RomiSerialClientImpl::filter_pushed_frame()
+        {
+                bool is_response = true;
+                const char *message = parser_.message();
+                // The opcode, the topic, and the zero at the end.
+                if (parser_.length() > 2 && is_pushed_frame()) {
+                        ROMISERIAL_TRACE_INSTANT("pushed frame", "client",
+                                                 "sequence", parser_.id());
+                        double sample_time = 0.0;
+                        double error;
+                        if (parser_.has_timestamp())
+                                clock_.to_host_time(parser_.timestamp(), sample_time, error);
+                        telemetry_.dispatch(message[1], (uint8_t) parser_.id(),
+                                            message + 2,
+                                            (size_t) (parser_.length() - 3),
+                                            rtime(), sample_time);
+                        is_response = false;
+                }
+                return is_response;
+        }
+
+        bool RomiSerialClientImpl::filter_log_message()
+        {
+                bool is_message = true;
+                const char *message = parser_.message();
+                if (parser_.length() > 1 && message[0] == '!') {
+                        ROMISERIAL_TRACE_INSTANT("log frame", "client",
+                                                 "length", parser_.length());
+                        if (parser_.length() > 2) {
+                                // Printed by the background thread
+                                // of firmware_log_.
+                                firmware_log_.post(message + 1,
+                                                   (size_t) (parser_.length() - 2));
+                                is_message = false;
+                        } else {
+                                is_message = false;
+                        }
+                }
+                return is_message;
+        }
+
+        bool RomiSerialClientImpl::handle_one_char()
+        {
+                bool has_message = false;
+                char c;
+                if (in_->read(c)) {
+
+                        metrics_.count_bytes_in(1);
+                        has_message = parse_char(c);
+                        if (has_message) {
+                                ROMISERIAL_TRACE_INSTANT("envelope complete", "client",
+                                                         "id", parser_.id());
+                                frame_received();
+                        }
+                
+                } else {
+                        // This timeout results from reading a single
+                        // character. The timeout value was set in the
+                        // constructor: in_->set_timeout().
+
+                        // This timeout is ignored here. We will only
+                        // check the total timeout for the whole
+                        // message.
+                        
+                        //result = make_error(romiserialclient_connection_timeout);
+                        //break;
+                }
+                return has_message;
+        }
+
+        bool RomiSerialClientImpl::read_response(ClientRequest& request, double timeout)
+        {
+                Response& response = request.response();
+                char opcode = *request.encoder().message();
+                double start_time;
+                bool has_response = false;
+                bool matched = false;
+
+                // Poll the input often enough to honour short
+                // timeouts, and to notice cancellations quickly.
+                double poll = std::clamp(timeout / 4.0, 0.001,
+                                         kRomiSerialClientCancelPoll);
+                in_->set_timeout((float) poll);
+
+                ROMISERIAL_TRACE_SCOPE("read response", "client");
+                start_time = rtime();
+                bool first_byte = true;
+                link_.allow_silence(start_time + rtt_.budget(opcode));
+        
+                while (!has_response) {
+                
+                        if (in_->available()) {
+                                trace_first_byte(first_byte);
+                        
+                                bool has_message = handle_one_char();
+                        
+                                if (has_message) 
+                                        has_message = filter_log_message();
+                                if (has_message)
+                                        has_message = filter_pushed_frame();
+
+                                if (has_message) {
+
+                                        if (debug_) {
+                                                log_->debug("RomiSerialClient<%s>::"
+                                                            "read_response: %s",
+                                                            client_name_.c_str(),
+                                                            parser_.message());
+                                        }
+
+                                        parse_response(response);
+
+                                        // Check whether we have a valid response.
+                                        if (parser_.id() == id_) {
+                                                has_response = true;
+                                                matched = true;
+
+                                        } else if (abandoned_.test(parser_.id())
+                                                   || response.status() == kDuplicate) {
+                                                /* The late response
+                                                 * of a cancelled or
+                                                 * expired request, or
+                                                 * the firmware's reply
+                                                 * to an earlier copy
+                                                 * of a re-sent
+                                                 * request. */
+                                                if (debug_) {
+                                                        log_->debug("RomiSerialClient<%s>: "
+                                                                    "discarding late response: '%s'",
+                                                                    client_name_.c_str(),
+                                                                    parser_.message());
+                                                }
+                                                response.set_error(kConnectionTimeout);
+                                                metrics_.count_id_mismatch(opcode);
+                                                parser_.reset();
+                                        
+                                        } else if (response.status() != 0) {
+                                                /* It's OK if the ID in the
+                                                 * response is not equal to
+                                                 * the ID in the request when
+                                                 * the response is an error
+                                                 * because errors can be sent
+                                                 * before the complete request
+                                                 * is parsed. */
+                                                has_response = true;
+                                        
+                                        } else {
+                                                /* There's an ID
+                                                 * mismatch. Drop this
+                                                 * response and try reading
+                                                 * the next one. */
+                                                log_->warn("RomiSerialClient<%s>: "
+                                                           "ID mismatch: "
+                                                           "request(%d) != response(%d): "
+                                                           "response: '%s'",
+                                                           client_name_.c_str(),
+                                                           id_, parser_.id(), 
+                                                           parser_.message());
+                                                metrics_.count_id_mismatch(opcode);
+                                                
+                                                // Try again
+                                                parser_.reset();
+                                        }
+                                
+                                } else if (parser_.error() != 0 && !is_pushed_frame()) {
+                                        log_->warn("RomiSerialClient<%s>: "
+                                                   "invalid response: '%s'",
+                                                   client_name_.c_str(),
+                                                   parser_.message());
+                                        set_error(response, parser_.error());
+                                        has_response = true;
+                                }
+                        }
+
+                        expire_queued_requests();
+
+                        // This timeout responses from reading the complete
+                        // message. Return an error if the reading requires
+                        // more than the timeout seconds.
+                        if (!has_response && request.is_cancelled()) {
+                                set_error(response, kRequestCancelled);
+                                abandoned_.set(id_);
+                                has_response = true;
+                        }
+
+                        if (!has_response && is_cut_off(request)) {
+                                set_error(response, kLinkDown);
+                                abandoned_.set(id_);
+                                has_response = true;
+                        }
+
+                        double now = rtime();
+                        if (!has_response && now - start_time > timeout) {
+                                if (request.has_expired(now)) {
+                                        set_error(response, kDeadlineExceeded);
+                                        abandoned_.set(id_);
+                                } else {
+                                        set_error(response, kConnectionTimeout);
+                                }
+                                has_response = true;
+                        }
+                }
+
+                return matched;
+        }
+
+        void RomiSerialClientImpl::send(const char *command, Response& response,
+                                        RequestPriority priority)
+        {
+                ClientRequest request(command);
+                request.set_priority(priority);
+                submit(request);
+                request.wait();
+                response = request.response();
+        }
+
+        void RomiSerialClientImpl::send(const CommandTemplate& command,
+                                        const int16_t *args, size_t count,
+                                        Response& response)
+        {
+                ClientRequest request;
+                request.set_command(command, args, count);
+                submit(request);
+                request.wait();
+                response = request.response();
+        }
+
+        void RomiSerialClientImpl::submit_batch(std::span<ClientRequest> requests)
+        {
+                if (requests.empty())
+                        return;
+                
+                double now = rtime();
+                for (ClientRequest& request : requests)
+                        request.set_pending(now);
+                requests[0].set_batch_size(requests.size());
+                
+                queues_[requests[0].priority()].push(&requests[0]);
+                wake_up();
+        }
+
+        void RomiSerialClientImpl::send_batch(std::span<const char * const> commands,
+                                              std::span<Response> responses)
+        {
+                size_t count = std::min(commands.size(), responses.size());
+                std::vector<ClientRequest> requests(count);
+                
+                for (size_t i = 0; i < count; i++)
+                        requests[i].set_command(commands[i]);
+
+                submit_batch(requests);
+                
+                for (size_t i = 0; i < count; i++) {
+                        requests[i].wait();
+                        responses[i] = requests[i].response();
+                }
+        }
+
+        void RomiSerialClientImpl::subscribe(char topic, TelemetryCallback callback)
+        {
+                telemetry_.subscribe(topic, callback);
+                wake_up();
+        }
+
+        void RomiSerialClientImpl::subscribe(char topic,
+                                             std::shared_ptr<TelemetryQueue> queue)
+        {
+                telemetry_.subscribe(topic, queue);
+                wake_up();
+        }
+
+        void RomiSerialClientImpl::unsubscribe(char topic)
+        {
+                telemetry_.unsubscribe(topic);
+        }
+
+        TelemetryStatistics RomiSerialClientImpl::get_telemetry_statistics() const
+        {
+                return telemetry_.get_statistics();
+        }
+
+        bool RomiSerialClientImpl::load_handler_schema()
+        {
+                Response response;
+                int32_t values[3];
+                size_t count = 0;
+                bool success = false;
+
+                schema_.clear();
+
+                // A device that does not answer, or is still
+                // booting, should not stall create().
+                ClientRequest probe("$");
+                probe.set_deadline(rtime() + kRomiSerialClientProbeTimeout);
+                submit(probe);
+                probe.wait();
+                response = probe.response();
+                
+                if (response.get_values(values, 3, count) == kNoError
+                    && count == 2 && values[0] >= 0) {
+                        
+                        size_t n = (size_t) values[0];
+                        int features = values[1];
+                        std::vector<std::string> commands(n);
+                        std::vector<const char*> pointers(n);
+                        std::vector<Response> responses(n);
+
+                        for (size_t i = 0; i < n; i++) {
+                                commands[i] = "$[" + std::to_string(i) + "]";
+                                pointers[i] = commands[i].c_str();
+                        }
+                        
+                        send_batch(pointers, responses);
+
+                        success = true;
+                        for (size_t i = 0; i < n; i++) {
+                                if (responses[i].get_values(values, 3, count) == kNoError
+                                    && count == 3) {
+                                        HandlerInfo info;
+                                        info.opcode = (char) values[0];
+                                        info.number_arguments = (uint8_t) values[1];
+                                        info.requires_string = (values[2] != 0);
+                                        schema_.add(info);
+                                } else {
+                                        success = false;
+                                }
+                        }
+                        
+                        if (success)
+                                schema_.set_loaded(features);
+                        if (success && (features & kFeatureLongId) != 0)
+                                set_long_ids(true);
+                }
+
+                // Firmware that predates introspection rejects the
+                // '$' opcode in its parser (kInvalidOpcode), or has
+                // no handler for it (kUnknownOpcode). That is not
+                // worth a warning.
+                int status = response.status();
+                if (!success
+                    && status != kInvalidOpcode
+                    && status != kUnknownOpcode) {
+                        log_->warn("RomiSerialClient<%s>: Failed to load the "
+                                   "handler table. Requests are not validated.",
+                                   client_name_.c_str());
+                }
+                return success;
+        }
+
+        bool RomiSerialClientImpl::get_handler_info(char opcode, HandlerInfo& info) const
+        {
+                return schema_.get(opcode, info);
+        }
+
+        int RomiSerialClientImpl::get_firmware_features() const
+        {
+                return schema_.features();
+        }
+
+        FirmwareLogStatistics RomiSerialClientImpl::get_firmware_log_statistics() const
+        {
+                return firmware_log_.get_statistics();
+        }
+
+        LinkMetricsSnapshot RomiSerialClientImpl::get_metrics() const
+        {
+                return metrics_.get();
+        }
+
+        void RomiSerialClientImpl::frame_received()
+        {
+                if (link_.frame_received(rtime()))
+                        log_->warn("RomiSerialClient<%s>: link is up",
+                                   client_name_.c_str());
+        }
+
+        void RomiSerialClientImpl::start_heartbeat(double period, int max_missed)
+        {
+                stop_heartbeat();
+                
+                if (period <= 0.0 || max_missed < 1)
+                        throw std::invalid_argument("RomiSerialClient::start_heartbeat: "
+                                                    "invalid period or count");
+                
+                link_.reset(rtime());
+                heartbeat_quit_ = false;
+                heartbeat_thread_ = std::thread(&RomiSerialClientImpl::run_heartbeat, this,
+                                                period, period * max_missed);
+        }
+
+        void RomiSerialClientImpl::stop_heartbeat()
+        {
+                {
+                        std::lock_guard<std::mutex> lock(heartbeat_mutex_);
+                        heartbeat_quit_ = true;
+                }
+                heartbeat_condition_.notify_one();
+                if (heartbeat_thread_.joinable())
+                        heartbeat_thread_.join();
+                // Without heartbeat, the link cannot come back up.
+                link_.reset(rtime());
+        }
+
+        void RomiSerialClientImpl::run_heartbeat(double period, double threshold)
+        {
+                Tracer::set_thread_name("RomiSerialClient<" + client_name_ + ">: heartbeat");
+                
+                const char command[] = { kHeartbeatOpcode, '\0' };
+                ClientRequest heartbeat(command);
+                bool outstanding = false;
+                double next = rtime();
+                
+                heartbeat.set_priority(kHighPriority);
+                
+                std::unique_lock<std::mutex> lock(heartbeat_mutex_);
+                while (true) {
+                        next += period;
+                        std::chrono::duration<double> delay(next - rtime());
+                        if (heartbeat_condition_.wait_for(lock, delay,
+                                                          [this]() { return heartbeat_quit_; }))
+                                break;
+
+                        double now = rtime();
+                        if (outstanding && heartbeat.is_complete()) {
+                                int status = heartbeat.response().status();
+                                if (status == kConnectionTimeout
+                                    || status == kDeadlineExceeded)
+                                        link_.count_missed_heartbeat();
+                                outstanding = false;
+                        }
+
+                        if (link_.check(now, threshold)) {
+                                ROMISERIAL_TRACE_INSTANT("link down", "client");
+                                log_->warn("RomiSerialClient<%s>: link is down: "
+                                           "no response for %.3f s",
+                                           client_name_.c_str(), link_.silence(now));
+                        }
+
+                        // The request is reused once it completed.
+                        if (!outstanding && link_.silence(now) >= period) {
+                                heartbeat.set_deadline(now + threshold);
+                                link_.count_heartbeat();
+                                outstanding = true;
+                                submit(heartbeat);
+                        }
+
+                        // Don't try to catch up after a stall.
+                        if (next < now)
+                                next = now;
+                }
+
+                if (outstanding)
+                        heartbeat.wait();
+        }
+
+        bool RomiSerialClientImpl::is_link_up() const
+        {
+                return !link_.is_down();
+        }
+
+        LinkHealth RomiSerialClientImpl::get_link_health() const
+        {
+                return link_.get_health(rtime());
+        }
+
+        bool RomiSerialClientImpl::enable_timestamps(bool value)
+        {
+                if (schema_.is_loaded()
+                    && (schema_.features() & kFeatureTimestamp) == 0)
+                        return false;
+                
+                const char command[] = { kClockOpcode, '[', value? '1' : '0', ']', '\0' };
+                Response response;
+                send(command, response, kHighPriority);
+                if (!response.is_ok())
+                        return false;
+
+                clock_.reset();
+                if (value) {
+                        const char sync[] = { kClockOpcode, '\0' };
+                        for (int i = 0; i < kClockSyncRequests; i++)
+                                send(sync, response, kHighPriority);
+                }
+                return true;
+        }
+
+        bool RomiSerialClientImpl::to_host_time(uint32_t micros, double& time,
+                                                double& error) const
+        {
+                return clock_.to_host_time(micros, time, error);
+        }
+
+        ClockEstimate RomiSerialClientImpl::get_clock_estimate() const
+        {
+                return clock_.get_estimate();
+        }
+
+        void RomiSerialClientImpl::set_receive_buffer_size(size_t bytes)
+        {
+                receive_buffer_size_ = bytes;
+        }
+
+        void RomiSerialClientImpl::send(const char *command, nlohmann::json& response)
+        {
+                ClientRequest request(command);
+                submit(request);
+                request.wait();
+                response = request.response().json();
+                check_json_response(request.response(), response);
+        }
+
+        void RomiSerialClientImpl::check_json_response(const Response& raw,
+                                                       nlohmann::json& response)
+        {
+                int code = response[kStatusCode];
+
+                if (raw.has_payload() && code != raw.status()) {
+                        log_->warn("RomiSerialClient<%s>: invalid response: "
+                                   "'%s' (%s)",
+                                   client_name_.c_str(), raw.payload(),
+                                   get_error_message(code));
+
+                } else if (code != 0 && debug_) {
+                        log_->debug("RomiSerialClient<%s>: "
+                                    "Firmware returned error: %d (%s)",
+                                    client_name_.c_str(), code,
+                                    to_string(response[kErrorMessage]).c_str());
+                }
+        }
+
+        uint16_t RomiSerialClientImpl::id()
+        {
+                return id_;
+        }
+
+        uint16_t RomiSerialClientImpl::id_mask() const
+        {
+                return long_ids_? 0xffff : 0xff;
+        }
+
+        void RomiSerialClientImpl::next_id()
+        {
+                id_ = (uint16_t) ((id_ + 1) & id_mask());
+                abandoned_.reset(id_);
+        }
+
+        // When long IDs are enabled, the sequence continues with the
+        // high byte of the start ID.
+        void RomiSerialClientImpl::set_long_ids(bool value)
+        {
+                if (value)
+                        id_ = (uint16_t) ((start_id_ & 0xff00) | (id_ & 0xff));
+                else
+                        id_ = (uint16_t) (id_ & 0xff);
+                long_ids_ = value;
+        }
+
+        bool RomiSerialClientImpl::has_long_ids() const
+        {
+                return long_ids_;
+        }
+        
+        void RomiSerialClientImpl::set_debug(bool value)
+        {
+                debug_ = value;
+        }
+
+        void RomiSerialClientImpl::set_timeout_limits(double floor, double ceiling)
+        {
+                rtt_.set_limits(floor, ceiling);
+        }
+
+        void RomiSerialClientImpl::set_timeout_budget(char opcode, double seconds)
+        {
+                rtt_.set_budget(opcode, seconds);
+        }
+
+        void RomiSerialClientImpl::set_retry_policy(std::shared_ptr<IRetryPolicy> policy)
+        {
+                retry_policy_ = policy;
+        }
+
+        RetryStatistics RomiSerialClientImpl::get_retry_statistics() const
+        {
+                return retry_counters_.get();
+        }
+
+        LaneStatistics RomiSerialClientImpl::get_lane_statistics(RequestPriority priority) const
+        {
+                return lane_counters_[priority].get();
+        }
+
+        void RomiSerialClientImpl::set_read_only(char opcode, bool value)
+        {
+                if ((opcode & 0x80) == 0)
+                        read_only_[(int) opcode].store(value, std::memory_order_relaxed);
+        }
+
+        uint32_t RomiSerialClientImpl::get_coalesced_requests() const
+        {
+                return coalesced_requests_.load(std::memory_order_relaxed);
+        }
+
+        void RomiSerialClientImpl::set_cache_ttl(char opcode, double seconds)
+        {
+                cache_.set_ttl(opcode, seconds);
+        }
+
+        void RomiSerialClientImpl::set_cache_invalidation(char write_opcode, char read_opcode)
+        {
+                cache_.link(write_opcode, read_opcode);
+        }
+
+        void RomiSerialClientImpl::invalidate_cache(char opcode)
+        {
+                cache_.invalidate(opcode);
+        }
+
+        void RomiSerialClientImpl::invalidate_cache()
+        {
+                cache_.clear();
+        }
+
+        CacheStatistics RomiSerialClientImpl::get_cache_statistics() const
+        {
+                return cache_.get_statistics();
+        }
+
+        // Called from any thread, while the I/O thread updates
+        // the estimator.
+        double RomiSerialClientImpl::get_timeout(char opcode)
+        {
+                return rtt_.published_timeout(opcode);
+        }
+}
+
+#endif
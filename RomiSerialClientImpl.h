@@ -0,0 +1,237 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_ROMISERIALCLIENTIMPL_H
+#define __ROMISERIAL_ROMISERIALCLIENTIMPL_H
+
+#if !defined(ARDUINO)
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <bitset>
+#include <span>
+#include <vector>
+#include <RomiSerialClient.h>
+#include <MPSCQueue.h>
+#include <RttEstimator.h>
+#include <EnvelopeParser.h>
+
+namespace romiserial {
+
+        /**
+         *  The state and the I/O thread of a RomiSerialClient. This
+         *  header is internal to the library: the clients only see
+         *  RomiSerialClient.h. See there for the documentation of
+         *  the public functions.
+         */
+        class RomiSerialClientImpl
+        {
+        protected:
+                std::shared_ptr<IInputStream> in_;
+                std::shared_ptr<IOutputStream> out_;
+                std::shared_ptr<ILog> log_;
+                uint16_t id_;
+                const uint16_t start_id_;
+                // IDs with four hex digits, see set_long_ids().
+                bool long_ids_;
+                // The IDs of the requests that were abandoned
+                // because they were cancelled or past their
+                // deadline. Their late responses are discarded.
+                std::bitset<65536> abandoned_;
+                bool debug_;
+                StaticEnvelopeParser<MAX_RESPONSE_LENGTH> parser_;
+                RttEstimator rtt_;
+                std::shared_ptr<IRetryPolicy> retry_policy_;
+                RetryCounters retry_counters_;
+                const std::string client_name_;
+
+                // The submitted requests are handled, one at a time,
+                // by the I/O thread. Only the I/O thread accesses the
+                // input and output streams. There is one queue per
+                // priority class.
+                MPSCQueue<ClientRequest> queues_[kNumberOfPriorities];
+                LaneCounters lane_counters_[kNumberOfPriorities];
+
+                // While it waits for a response, the I/O thread moves
+                // the queued requests to these lists, in order, to
+                // drop the ones that are cancelled or past their
+                // deadline. They are handled before the lane queues.
+                ClientRequest *backlog_head_[kNumberOfPriorities];
+                ClientRequest *backlog_tail_[kNumberOfPriorities];
+                double next_expiry_check_;
+
+                // Identical requests for read-only opcodes are
+                // coalesced: a request that finds an identical one in
+                // flight waits for its response instead of being
+                // sent. The mutex is only taken for these opcodes.
+                std::atomic<bool> read_only_[128];
+                std::mutex in_flight_mutex_;
+                ClientRequest *in_flight_;
+                std::atomic<uint32_t> coalesced_requests_;
+
+                // Responses of slowly changing queries are served
+                // from the cache without touching the link.
+                ResponseCache cache_;
+
+                // Batches are written in chunks that fit in the
+                // receive buffer of the firmware. The buffer is only
+                // used by the I/O thread.
+                size_t receive_buffer_size_;
+                std::vector<char> batch_buffer_;
+
+                // Frames pushed by the firmware.
+                TelemetryDispatcher telemetry_;
+
+                // The handler table of the firmware, used to reject
+                // malformed requests before they are sent.
+                HandlerSchema schema_;
+
+                // Always-on counters, updated by the I/O thread.
+                LinkMetrics metrics_;
+
+                // The log frames of the firmware are printed by a
+                // background thread.
+                FirmwareLog firmware_log_;
+
+                // The heartbeat thread checks the link and sends a
+                // heartbeat request when the firmware is silent.
+                LinkMonitor link_;
+                std::mutex heartbeat_mutex_;
+                std::condition_variable heartbeat_condition_;
+                bool heartbeat_quit_;
+                std::thread heartbeat_thread_;
+
+                // Maps the timestamps of the firmware to the host
+                // clock. Updated by the I/O thread.
+                ClockEstimator clock_;
+
+                std::atomic<uint32_t> signal_;
+                std::atomic<bool> quit_;
+                std::thread thread_;
+
+                void run();
+                void run_heartbeat(double period, double threshold);
+                void wake_up();
+                bool is_cut_off(const ClientRequest& request);
+                void frame_received();
+                uint16_t id_mask() const;
+                void next_id();
+                void read_pushed_frames(uint32_t signal);
+                bool handle_pending_requests();
+                ClientRequest *next_request();
+                ClientRequest *pop_request(RequestPriority priority);
+                void expire_queued_requests();
+                void pause(double delay);
+                void handle_request(ClientRequest& request);
+                bool can_coalesce(const ClientRequest& request) const;
+                int validate(const ClientRequest& request) const;
+                bool join_in_flight(ClientRequest& request);
+                bool lookup_cache(ClientRequest& request);
+                void update_cache(ClientRequest& request);
+                void complete_in_flight(ClientRequest& request);
+                void try_sending_request(ClientRequest& request,
+                                         int first_attempt = 1);
+                void handle_batch(ClientRequest *requests, size_t count);
+                size_t pipeline_batch(std::vector<ClientRequest*>& frames,
+                                      size_t start);
+                bool resend_if_failed(std::vector<ClientRequest*>& frames,
+                                      size_t failed);
+                bool write_batch(size_t length);
+                int read_any_response(Response& response, double timeout);
+                bool send_request(EnvelopeEncoder& request);
+                void set_error(Response& response, int code);
+                bool handle_one_char();
+                bool parse_char(int c);
+                void trace_first_byte(bool& first_byte);
+                void parse_response(Response& response);
+                bool read_response(ClientRequest& request, double timeout);
+                bool can_write();
+                bool filter_log_message();
+                bool filter_pushed_frame();
+                bool is_pushed_frame();
+                void check_json_response(const Response& raw,
+                                         nlohmann::json& response);
+
+        public:
+                RomiSerialClientImpl(std::shared_ptr<IInputStream> in,
+                                     std::shared_ptr<IOutputStream> out,
+                                     std::shared_ptr<ILog> log,
+                                     uint16_t start_id,
+                                     const std::string& client_name);
+                RomiSerialClientImpl(const RomiSerialClientImpl&) = delete;
+                RomiSerialClientImpl& operator=(const RomiSerialClientImpl&) = delete;
+                ~RomiSerialClientImpl();
+
+                uint16_t id();
+                void set_long_ids(bool value);
+                bool has_long_ids() const;
+                void send(const char *command, nlohmann::json& response);
+                void send(const char *command, Response& response,
+                          RequestPriority priority);
+                void send(const CommandTemplate& command,
+                          const int16_t *args, size_t count,
+                          Response& response);
+                void submit(ClientRequest& request);
+                void send_batch(std::span<const char * const> commands,
+                                std::span<Response> responses);
+                void submit_batch(std::span<ClientRequest> requests);
+                void set_receive_buffer_size(size_t bytes);
+                void subscribe(char topic, TelemetryCallback callback);
+                void subscribe(char topic, std::shared_ptr<TelemetryQueue> queue);
+                void unsubscribe(char topic);
+                TelemetryStatistics get_telemetry_statistics() const;
+                bool load_handler_schema();
+                bool get_handler_info(char opcode, HandlerInfo& info) const;
+                int get_firmware_features() const;
+                FirmwareLogStatistics get_firmware_log_statistics() const;
+                LinkMetricsSnapshot get_metrics() const;
+                void start_heartbeat(double period, int max_missed);
+                void stop_heartbeat();
+                bool is_link_up() const;
+                LinkHealth get_link_health() const;
+                bool enable_timestamps(bool value);
+                bool to_host_time(uint32_t micros, double& time, double& error) const;
+                ClockEstimate get_clock_estimate() const;
+                void set_debug(bool value);
+                void set_timeout_limits(double floor, double ceiling);
+                void set_timeout_budget(char opcode, double seconds);
+                double get_timeout(char opcode);
+                void set_retry_policy(std::shared_ptr<IRetryPolicy> policy);
+                RetryStatistics get_retry_statistics() const;
+                LaneStatistics get_lane_statistics(RequestPriority priority) const;
+                void set_read_only(char opcode, bool value);
+                uint32_t get_coalesced_requests() const;
+                void set_cache_ttl(char opcode, double seconds);
+                void set_cache_invalidation(char write_opcode, char read_opcode);
+                void invalidate_cache(char opcode);
+                void invalidate_cache();
+                CacheStatistics get_cache_statistics() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_ROMISERIALCLIENTIMPL_H
@@ -0,0 +1,150 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include "RomiSerialErrors.h"
+
+namespace romiserial {
+
+        const char *get_error_message(int code)
+        {
+                const char *r = nullptr;
+                switch (code) {
+                
+                case kNoError:
+                        r = "No error";
+                        break;
+                
+                case kEnvelopeTooLong:
+                        r = "Request too long";
+                        break;
+                case kEnvelopeInvalidId:
+                        r = "Invalid ID in request envelope";
+                        break;
+                case kEnvelopeInvalidCrc:
+                        r = "Invalid CRC in request envelope";
+                        break;
+                case kEnvelopeCrcMismatch:
+                        r = "CRC mismatch in request envelope";
+                        break;
+                case kEnvelopeExpectedEnd:
+                        r = "Expected the end of the request envelope";
+                        break;
+                case kEnvelopeMissingMetadata:
+                        r = "Request envelope has no metadata";
+                        break;
+                case kEnvelopeInvalidDummyMetadata:
+                        r = "Request envelope invalid dummy metadata";
+                        break;
+
+                case kUnexpectedChar:
+                        r = "Unexpected character in request";
+                        break;
+                case kVectorTooLong:
+                        r = "Too many arguments";
+                        break;
+                case kValueOutOfRange:
+                        r = "Value out of range";
+                        break;
+                case kStringTooLong:
+                        r = "String too long";
+                        break;
+                case kInvalidString:
+                        r = "Invalid string";
+                        break;
+                case kTooManyStrings:
+                        r = "Too many strings";
+                        break;
+                case kInvalidOpcode:
+                        r = "Invalid opcode";
+                        break;
+                
+                case kDuplicate:
+                        r = "Duplicate message";
+                        break;
+                case kUnknownOpcode:
+                        r = "Unknown opcode";
+                        break;
+                case kBadNumberOfArguments:
+                        r = "Bad number of arguments";
+                        break;
+                case kMissingString:
+                        r = "Missin string argument";
+                        break;
+                case kBadString:
+                        r = "Bad string";
+                        break;
+                case kBadHandler:
+                        r = "Corrupt request handler";
+                        break;
+                
+                case kClientInvalidOpcode:
+                        r = "Invalid opcode";
+                        break;
+                case kClientTooLong:
+                        r = "Request too long";
+                        break;
+                case kConnectionTimeout:
+                        r = "The connection timed out";
+                        break;
+                case kEmptyRequest:
+                        r = "Null or zero-length request";
+                        break;
+                case kEmptyResponse:
+                        r = "Null or zero-length response";
+                        break;
+                case kInvalidJson:
+                        r = "Invalid JSON";
+                        break;
+                case kInvalidResponse:
+                        r = "Response is badly formed";
+                        break;
+                case kInvalidErrorResponse:
+                        r = "Response contains an invalid error message";
+                        break;
+                case kRequestCancelled:
+                        r = "Request cancelled";
+                        break;
+                case kDeadlineExceeded:
+                        r = "Deadline exceeded";
+                        break;
+                case kLinkDown:
+                        r = "Link down";
+                        break;
+                case kBatchAborted:
+                        r = "Batch aborted";
+                        break;
+                default:
+                        if (code > 0)
+                                r = "Application error";
+                        else
+                                r = "Unknown error code";
+                        break;
+                }
+                return r;
+        }
+}
+
+#endif
@@ -64,9 +64,20 @@ namespace romiserial {
                 kInvalidJson = -26,
                 kInvalidResponse = -27,
                 kInvalidErrorResponse = -28,
+                kRequestCancelled = -29,
+                kDeadlineExceeded = -30,
+                // The heartbeat declared the link down.
+                kLinkDown = -31,
+                // An earlier frame of the batch failed.
+                kBatchAborted = -32,
         
-                kLastError = -29
+                kLastError = -33
         };
+
+#if !defined(ARDUINO)
+        // A short description of the error code.
+        const char *get_error_message(int code);
+#endif
 }
 
 #endif // __ROMISERIAL_ROMISERIALERRORS_H
@@ -0,0 +1,35 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_ROMISERIALJSON_H
+#define __ROMISERIAL_ROMISERIALJSON_H
+
+// The client headers only declare the JSON types. Include this
+// header to use RomiSerialClient::send() with a JSON response, or
+// Response::json().
+
+#include <json.hpp>
+#include <IRomiSerialClient.h>
+#include <Response.h>
+
+#endif // __ROMISERIAL_ROMISERIALJSON_H
@@ -22,7 +22,11 @@
 
  */
 
-#include <ctype.h>
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include "rtime.h"
+#endif
 #include "RomiSerialUtil.h"
 
 namespace romiserial {
@@ -33,8 +37,12 @@ namespace romiserial {
                 return (value < 10)? (char)('0' + value) : (char)('a' + (value - 10));
         }
 
-        bool is_valid_opcode(char c)
+        uint32_t timestamp_micros()
         {
-                return isalnum(c) || (c == '?');
+#if defined(ARDUINO)
+                return micros();
+#else
+                return (uint32_t) (uint64_t) (rmonotonic() * 1.0e6);
+#endif
         }
 }
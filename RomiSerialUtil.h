@@ -28,8 +28,74 @@
 #include <stdint.h>
 
 namespace romiserial {
-        bool is_valid_opcode(char c);
+
+        // Frames that the firmware sends on its own, outside of a
+        // request, start with this reserved opcode followed by a
+        // topic character. Their ID field holds a sequence number.
+        constexpr char kPushOpcode = '*';
+
+        // The reserved opcode of the requests that return the
+        // handler table of the firmware: "$" returns [0,n,features]
+        // and "$[i]" returns [0,opcode,arguments,requires_string]
+        // for the i-th handler.
+        constexpr char kIntrospectionOpcode = '$';
+
+        // The reserved opcode of the heartbeat requests of the
+        // client. The firmware answers [0] without calling a
+        // handler.
+        constexpr char kHeartbeatOpcode = '~';
+
+        // The reserved opcode that switches the timestamps of the
+        // firmware on or off: "@[1]" adds the micros() of the
+        // firmware to the metadata of the responses and of the
+        // pushed frames, "@[0]" stops it, and "@" returns
+        // [0,enabled].
+        constexpr char kClockOpcode = '@';
+
+        // The bits of the features field.
+        constexpr int kFeaturePush = 1;
+        // The firmware accepts IDs with four hex digits.
+        constexpr int kFeatureLongId = 2;
+        // The firmware answers heartbeats (kHeartbeatOpcode).
+        constexpr int kFeatureHeartbeat = 4;
+        // The firmware can timestamp its messages (kClockOpcode).
+        constexpr int kFeatureTimestamp = 8;
+
+        // constexpr so that typed commands can check their opcode at
+        // compile time (see TypedCommand.h).
+        constexpr bool is_valid_opcode(char c)
+        {
+                return (('a' <= c && c <= 'z')
+                        || ('A' <= c && c <= 'Z')
+                        || ('0' <= c && c <= '9')
+                        || (c == '?')
+                        || (c == kIntrospectionOpcode)
+                        || (c == kHeartbeatOpcode)
+                        || (c == kClockOpcode));
+        }
+
+        // The characters that the firmware accepts in a string
+        // argument (see VALID_STRING_CHAR in MessageParser.cpp).
+        constexpr bool is_valid_string_char(char c)
+        {
+                return (('a' <= c && c <= 'z')
+                        || ('A' <= c && c <= 'Z')
+                        || ('0' <= c && c <= '9')
+                        || c == '-' || c == '_' || c == ' ' || c == '!'
+                        || c == '?' || c == '%' || c == '(' || c == ')'
+                        || c == '[' || c == ']' || c == '{' || c == '}'
+                        || c == '&' || c == '=' || c == '+' || c == '*'
+                        || c == '/' || c == '.' || c == ',' || c == ';'
+                        || c == ':' || c == '\'');
+        }
+
         char to_hex(uint8_t value);
+
+        // The time of the firmware in microseconds: micros() on the
+        // Arduino, the monotonic clock (see rmonotonic()) when the
+        // firmware runs on the host. It wraps around after 71
+        // minutes.
+        uint32_t timestamp_micros();
 }
 
 #endif // __ROMISERIAL_UTIL_H
@@ -0,0 +1,143 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <math.h>
+#include "RttEstimator.h"
+
+namespace romiserial {
+
+        RttEstimator::RttEstimator()
+                : published_(), floor_(kDefaultFloor), ceiling_(kDefaultCeiling)
+        {
+                for (int i = 0; i < 128; i++) {
+                        entries_[i].srtt = 0.0;
+                        entries_[i].rttvar = 0.0;
+                        entries_[i].budget = 0.0;
+                        entries_[i].backoff = 0;
+                        entries_[i].has_sample = false;
+                }
+                publish_all();
+        }
+
+        RttEstimator::Entry *RttEstimator::get(char opcode)
+        {
+                return &entries_[(uint8_t) opcode & 0x7f];
+        }
+
+        const RttEstimator::Entry *RttEstimator::get(char opcode) const
+        {
+                return &entries_[(uint8_t) opcode & 0x7f];
+        }
+
+        void RttEstimator::publish(char opcode)
+        {
+                published_[(uint8_t) opcode & 0x7f].store(timeout(opcode),
+                                                          std::memory_order_relaxed);
+        }
+
+        void RttEstimator::publish_all()
+        {
+                for (int i = 0; i < 128; i++)
+                        publish((char) i);
+        }
+
+        void RttEstimator::set_limits(double floor, double ceiling)
+        {
+                floor_ = floor;
+                ceiling_ = (ceiling > floor)? ceiling : floor;
+                publish_all();
+        }
+
+        void RttEstimator::set_budget(char opcode, double seconds)
+        {
+                get(opcode)->budget = seconds;
+                publish(opcode);
+        }
+
+        void RttEstimator::update(char opcode, double rtt)
+        {
+                Entry *entry = get(opcode);
+                if (entry->has_sample) {
+                        entry->rttvar = ((1.0 - kBeta) * entry->rttvar
+                                         + kBeta * fabs(entry->srtt - rtt));
+                        entry->srtt = (1.0 - kAlpha) * entry->srtt + kAlpha * rtt;
+                } else {
+                        entry->srtt = rtt;
+                        entry->rttvar = rtt / 2.0;
+                        entry->has_sample = true;
+                }
+                entry->backoff = 0;
+                publish(opcode);
+        }
+
+        void RttEstimator::backoff(char opcode)
+        {
+                Entry *entry = get(opcode);
+                if (entry->backoff < 16)
+                        entry->backoff++;
+                publish(opcode);
+        }
+
+        double RttEstimator::timeout(char opcode) const
+        {
+                const Entry *entry = get(opcode);
+                double value = ceiling_;
+
+                if (entry->has_sample) {
+                        value = entry->srtt + 4.0 * entry->rttvar;
+                        value = ldexp(value, entry->backoff);
+                        if (value < floor_)
+                                value = floor_;
+                        if (value > ceiling_)
+                                value = ceiling_;
+                }
+                if (value < entry->budget)
+                        value = entry->budget;
+                return value;
+        }
+
+        double RttEstimator::published_timeout(char opcode) const
+        {
+                return published_[(uint8_t) opcode & 0x7f].load(std::memory_order_relaxed);
+        }
+
+        double RttEstimator::budget(char opcode) const
+        {
+                return get(opcode)->budget;
+        }
+
+        double RttEstimator::srtt(char opcode) const
+        {
+                return get(opcode)->srtt;
+        }
+
+        double RttEstimator::rttvar(char opcode) const
+        {
+                return get(opcode)->rttvar;
+        }
+}
+
+#endif
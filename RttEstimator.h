@@ -0,0 +1,111 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_RTTESTIMATOR_H
+#define __ROMISERIAL_RTTESTIMATOR_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <atomic>
+
+namespace romiserial {
+
+        /**
+         *  Estimates the round-trip time of the requests, per opcode,
+         *  and derives the time the client should wait for a
+         *  response. It uses the smoothed RTT and RTT variance of TCP
+         *  (RFC 6298):
+         *
+         *    rttvar = (1 - beta) * rttvar + beta * |srtt - rtt|
+         *    srtt = (1 - alpha) * srtt + alpha * rtt
+         *    timeout = srtt + 4 * rttvar
+         *
+         *  The timeout is clamped between a floor and a ceiling, and
+         *  doubles after each timeout until a new sample comes in.
+         *  An opcode without samples uses the ceiling. Handlers that
+         *  are slow can declare a budget, which is used as a lower
+         *  bound for the timeout of their opcode.
+         *
+         *  The estimator is not thread-safe. RomiSerialClient only
+         *  updates it from its I/O thread. The current timeouts are
+         *  also published in atomics, for published_timeout(),
+         *  which can be called from any thread.
+         */
+        class RttEstimator
+        {
+        public:
+                static constexpr double kAlpha = 0.125;
+                static constexpr double kBeta = 0.25;
+                static constexpr double kDefaultFloor = 0.020;
+                static constexpr double kDefaultCeiling = 2.0;
+
+        protected:
+                struct Entry {
+                        double srtt;
+                        double rttvar;
+                        double budget;
+                        uint8_t backoff;
+                        bool has_sample;
+                };
+
+                Entry entries_[128];
+                std::atomic<double> published_[128];
+                double floor_;
+                double ceiling_;
+
+                Entry *get(char opcode);
+                const Entry *get(char opcode) const;
+                void publish(char opcode);
+                void publish_all();
+
+        public:
+                RttEstimator();
+                ~RttEstimator() = default;
+
+                void set_limits(double floor, double ceiling);
+                void set_budget(char opcode, double seconds);
+                double budget(char opcode) const;
+
+                /** Adds a round-trip time measurement. Only
+                 * measurements of requests that were not re-sent
+                 * should be used (Karn's algorithm). */
+                void update(char opcode, double rtt);
+
+                /** Doubles the timeout of the opcode until the next
+                 * measurement. */
+                void backoff(char opcode);
+
+                double timeout(char opcode) const;
+
+                /** The value of timeout() after the last change.
+                 * Thread-safe. */
+                double published_timeout(char opcode) const;
+
+                double srtt(char opcode) const;
+                double rttvar(char opcode) const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_RTTESTIMATOR_H
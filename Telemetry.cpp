@@ -0,0 +1,174 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include "Telemetry.h"
+
+namespace romiserial {
+
+        // One slot is kept free to tell a full queue from an empty
+        // one.
+        TelemetryQueue::TelemetryQueue(size_t capacity)
+                : samples_(capacity + 1),
+                  head_(0),
+                  tail_(0),
+                  dropped_(0)
+        {
+        }
+
+        bool TelemetryQueue::push(const TelemetrySample& sample)
+        {
+                size_t tail = tail_.load(std::memory_order_relaxed);
+                size_t next = (tail + 1) % samples_.size();
+                bool success = false;
+                
+                if (next != head_.load(std::memory_order_acquire)) {
+                        samples_[tail] = sample;
+                        tail_.store(next, std::memory_order_release);
+                        success = true;
+                } else {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+                return success;
+        }
+
+        bool TelemetryQueue::pop(TelemetrySample& sample)
+        {
+                size_t head = head_.load(std::memory_order_relaxed);
+                bool success = false;
+
+                if (head != tail_.load(std::memory_order_acquire)) {
+                        sample = samples_[head];
+                        head_.store((head + 1) % samples_.size(),
+                                    std::memory_order_release);
+                        success = true;
+                }
+                return success;
+        }
+
+        TelemetryDispatcher::TelemetryDispatcher()
+                : mutex_(),
+                  subscribers_(),
+                  targets_(),
+                  has_subscribers_(false),
+                  has_sequence_(false),
+                  last_sequence_(0),
+                  sample_(),
+                  received_(0),
+                  lost_(0),
+                  dropped_(0),
+                  ignored_(0)
+        {
+        }
+
+        void TelemetryDispatcher::subscribe(char topic, TelemetryCallback callback)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                subscribers_.push_back({topic, callback, nullptr});
+                has_subscribers_.store(true, std::memory_order_release);
+        }
+
+        void TelemetryDispatcher::subscribe(char topic,
+                                            std::shared_ptr<TelemetryQueue> queue)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                subscribers_.push_back({topic, nullptr, queue});
+                has_subscribers_.store(true, std::memory_order_release);
+        }
+
+        void TelemetryDispatcher::unsubscribe(char topic)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto s = subscribers_.begin(); s != subscribers_.end(); ) {
+                        if (s->topic == topic)
+                                s = subscribers_.erase(s);
+                        else
+                                ++s;
+                }
+                has_subscribers_.store(!subscribers_.empty(), std::memory_order_release);
+        }
+
+        void TelemetryDispatcher::dispatch(char topic, uint8_t sequence,
+                                           const char *data, size_t length,
+                                           double time, double sample_time)
+        {
+                uint32_t lost = 0;
+                if (has_sequence_)
+                        lost = (uint8_t) (sequence - last_sequence_ - 1);
+                has_sequence_ = true;
+                last_sequence_ = sequence;
+                
+                received_.fetch_add(1, std::memory_order_relaxed);
+                if (lost > 0)
+                        lost_.fetch_add(lost, std::memory_order_relaxed);
+
+                // The subscribers are called without the lock, so
+                // that a callback can subscribe or unsubscribe.
+                targets_.clear();
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        for (const Subscriber& subscriber : subscribers_) {
+                                if (subscriber.topic == topic)
+                                        targets_.push_back(subscriber);
+                        }
+                }
+
+                bool delivered = !targets_.empty();
+                if (delivered) {
+                        // The sample is only decoded for topics that
+                        // have subscribers.
+                        sample_.topic = topic;
+                        sample_.sequence = sequence;
+                        sample_.lost = lost;
+                        sample_.time = time;
+                        sample_.sample_time = sample_time;
+                        sample_.data.set_payload(data, length);
+                }
+                
+                for (const Subscriber& subscriber : targets_) {
+                        if (subscriber.callback) {
+                                subscriber.callback(sample_);
+                        } else if (!subscriber.queue->push(sample_)) {
+                                dropped_.fetch_add(1, std::memory_order_relaxed);
+                        }
+                }
+                targets_.clear();
+
+                if (!delivered)
+                        ignored_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        TelemetryStatistics TelemetryDispatcher::get_statistics() const
+        {
+                TelemetryStatistics stats;
+                stats.received = received_.load(std::memory_order_relaxed);
+                stats.lost = lost_.load(std::memory_order_relaxed);
+                stats.dropped = dropped_.load(std::memory_order_relaxed);
+                stats.ignored = ignored_.load(std::memory_order_relaxed);
+                return stats;
+        }
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_TELEMETRY_H
+#define __ROMISERIAL_TELEMETRY_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <Response.h>
+
+namespace romiserial {
+
+        /**
+         *  A frame pushed by the firmware with IRomiSerial::push().
+         *  The data has the same form as a response, [0,v1,v2,...],
+         *  and is decoded with Response::get_values() or
+         *  Response::json().
+         */
+        struct TelemetrySample
+        {
+                char topic;
+                uint8_t sequence;
+                // The number of pushed frames, of any topic, that
+                // were lost on the link since the previous frame.
+                uint32_t lost;
+                // The time the frame was received, see rtime().
+                double time;
+                // The time the firmware sent the frame, on the
+                // monotonic clock of the host (see rmonotonic()), or
+                // zero when the firmware does not add timestamps or
+                // the clocks are not synchronized yet.
+                double sample_time;
+                Response data;
+        };
+
+        typedef std::function<void(const TelemetrySample& sample)> TelemetryCallback;
+
+        /**
+         *  A bounded, lock-free, single-producer single-consumer
+         *  queue of samples. The I/O thread of the client is the
+         *  producer. When the queue is full, new samples are dropped
+         *  and counted.
+         */
+        class TelemetryQueue
+        {
+        protected:
+                std::vector<TelemetrySample> samples_;
+                std::atomic<size_t> head_;
+                std::atomic<size_t> tail_;
+                std::atomic<uint32_t> dropped_;
+
+        public:
+                explicit TelemetryQueue(size_t capacity);
+                TelemetryQueue(const TelemetryQueue&) = delete;
+                TelemetryQueue& operator=(const TelemetryQueue&) = delete;
+                ~TelemetryQueue() = default;
+
+                /** Called by the producer. Returns false if the
+                 * queue is full. */
+                bool push(const TelemetrySample& sample);
+
+                /** Called by the consumer. Returns false if the
+                 * queue is empty. */
+                bool pop(TelemetrySample& sample);
+
+                size_t capacity() const {
+                        return samples_.size() - 1;
+                }
+
+                uint32_t dropped() const {
+                        return dropped_.load(std::memory_order_relaxed);
+                }
+        };
+
+        struct TelemetryStatistics
+        {
+                uint32_t received;
+                uint32_t lost;
+                // Samples that found a full queue.
+                uint32_t dropped;
+                // Frames of topics without subscribers.
+                uint32_t ignored;
+        };
+
+        /**
+         *  Keeps the subscriptions per topic, detects lost frames
+         *  using the sequence numbers, and hands the samples to the
+         *  subscribers. The callbacks are called by the I/O thread of
+         *  the client and should return quickly.
+         */
+        class TelemetryDispatcher
+        {
+        protected:
+                struct Subscriber {
+                        char topic;
+                        TelemetryCallback callback;
+                        std::shared_ptr<TelemetryQueue> queue;
+                };
+
+                std::mutex mutex_;
+                std::vector<Subscriber> subscribers_;
+                // The subscribers of the frame being dispatched.
+                // Only used by the I/O thread.
+                std::vector<Subscriber> targets_;
+                std::atomic<bool> has_subscribers_;
+                bool has_sequence_;
+                uint8_t last_sequence_;
+                TelemetrySample sample_;
+                std::atomic<uint32_t> received_;
+                std::atomic<uint32_t> lost_;
+                std::atomic<uint32_t> dropped_;
+                std::atomic<uint32_t> ignored_;
+
+        public:
+                TelemetryDispatcher();
+                ~TelemetryDispatcher() = default;
+
+                void subscribe(char topic, TelemetryCallback callback);
+                void subscribe(char topic, std::shared_ptr<TelemetryQueue> queue);
+                void unsubscribe(char topic);
+                
+                bool has_subscribers() const {
+                        return has_subscribers_.load(std::memory_order_acquire);
+                }
+
+                /** Called by the I/O thread for each pushed
+                 * frame. The data is the JSON array that follows the
+                 * topic. */
+                void dispatch(char topic, uint8_t sequence,
+                              const char *data, size_t length, double time,
+                              double sample_time = 0.0);
+
+                TelemetryStatistics get_statistics() const;
+        };
+}
+
+#endif
+#endif // __ROMISERIAL_TELEMETRY_H
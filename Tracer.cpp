@@ -0,0 +1,298 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Tracer.h"
+
+namespace romiserial {
+
+        namespace {
+
+                /* The buffer of one thread. Only the owner appends
+                 * events. The count is published with a release
+                 * store, so a reader that loads it sees the events
+                 * before it. The buffer is not a ring: events are
+                 * never overwritten while they are exported. The
+                 * thread and its name are those of the last owner,
+                 * and are guarded by the mutex of the registry. */
+                struct TraceBuffer
+                {
+                        std::unique_ptr<TraceEvent[]> events;
+                        std::atomic<size_t> count;
+                        std::atomic<uint64_t> dropped;
+                        bool in_use;
+                        uint32_t thread;
+                        std::string thread_name;
+
+                        TraceBuffer()
+                                : events(new TraceEvent[Tracer::kEventsPerThread]),
+                                  count(0), dropped(0), in_use(true),
+                                  thread(0), thread_name() {
+                        }
+                };
+
+                /* The buffers are owned by the registry, so that the
+                 * events of a thread outlive it. The buffer of a
+                 * thread that exited is reused by the next new
+                 * thread. The mutex is only taken when a thread
+                 * records its first event, and to export. */
+                struct TraceRegistry
+                {
+                        std::mutex mutex;
+                        std::vector<std::unique_ptr<TraceBuffer>> buffers;
+                };
+
+                TraceRegistry& registry()
+                {
+                        // Never destroyed: threads may record events
+                        // while the program exits.
+                        static TraceRegistry *instance = new TraceRegistry();
+                        return *instance;
+                }
+
+                std::atomic<uint32_t> next_thread_id(1);
+
+                struct ThreadState
+                {
+                        uint32_t id;
+                        TraceBuffer *buffer;
+                        std::string name;
+
+                        ThreadState()
+                                : id(next_thread_id.fetch_add(1, std::memory_order_relaxed)),
+                                  buffer(nullptr), name() {
+                        }
+
+                        ~ThreadState() {
+                                if (buffer != nullptr) {
+                                        std::lock_guard<std::mutex> lock(registry().mutex);
+                                        buffer->in_use = false;
+                                }
+                        }
+
+                        TraceBuffer *get_buffer() {
+                                if (buffer == nullptr)
+                                        buffer = claim_buffer();
+                                return buffer;
+                        }
+
+                        TraceBuffer *claim_buffer() {
+                                TraceRegistry& r = registry();
+                                std::lock_guard<std::mutex> lock(r.mutex);
+                                TraceBuffer *claimed = nullptr;
+                                for (auto& b : r.buffers) {
+                                        if (!b->in_use) {
+                                                claimed = b.get();
+                                                claimed->in_use = true;
+                                                break;
+                                        }
+                                }
+                                if (claimed == nullptr) {
+                                        r.buffers.push_back(std::make_unique<TraceBuffer>());
+                                        claimed = r.buffers.back().get();
+                                }
+                                claimed->thread = id;
+                                claimed->thread_name = name;
+                                return claimed;
+                        }
+                };
+
+                thread_local ThreadState thread_state;
+
+                uint64_t now_nanoseconds()
+                {
+                        struct timespec spec;
+                        clock_gettime(CLOCK_MONOTONIC, &spec);
+                        return (uint64_t) spec.tv_sec * 1000000000ull
+                                + (uint64_t) spec.tv_nsec;
+                }
+
+                void append_escaped(std::string& out, const char *s)
+                {
+                        for (; *s != '\0'; s++) {
+                                unsigned char c = (unsigned char) *s;
+                                if (c == '"' || c == '\\') {
+                                        out += '\\';
+                                        out += (char) c;
+                                } else if (c < 0x20) {
+                                        char hex[8];
+                                        snprintf(hex, sizeof(hex), "\\u%04x", c);
+                                        out += hex;
+                                } else {
+                                        out += (char) c;
+                                }
+                        }
+                }
+
+                void append_event(std::string& out, const TraceEvent& event, int pid)
+                {
+                        char buffer[128];
+                        out += "{\"name\":\"";
+                        append_escaped(out, event.name);
+                        out += "\",\"cat\":\"";
+                        append_escaped(out, event.category);
+                        snprintf(buffer, sizeof(buffer),
+                                 "\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%u",
+                                 event.phase,
+                                 (unsigned long long) (event.time / 1000),
+                                 (unsigned) (event.time % 1000),
+                                 pid, event.thread);
+                        out += buffer;
+                        if (event.phase == 'i')
+                                out += ",\"s\":\"t\"";
+                        if (event.arg_name != nullptr) {
+                                out += ",\"args\":{\"";
+                                append_escaped(out, event.arg_name);
+                                snprintf(buffer, sizeof(buffer), "\":%lld}",
+                                         (long long) event.arg);
+                                out += buffer;
+                        }
+                        out += "}";
+                }
+        }
+
+        std::atomic<bool> Tracer::enabled_(false);
+
+        void Tracer::start()
+        {
+                enabled_.store(true, std::memory_order_relaxed);
+        }
+
+        void Tracer::stop()
+        {
+                enabled_.store(false, std::memory_order_relaxed);
+        }
+
+        void Tracer::record(char phase, const char *name, const char *category,
+                            const char *arg_name, int64_t arg)
+        {
+                TraceBuffer *buffer = thread_state.get_buffer();
+                size_t count = buffer->count.load(std::memory_order_relaxed);
+                if (count < kEventsPerThread) {
+                        TraceEvent& event = buffer->events[count];
+                        event.name = name;
+                        event.category = category;
+                        event.arg_name = arg_name;
+                        event.arg = arg;
+                        event.time = now_nanoseconds();
+                        event.thread = thread_state.id;
+                        event.phase = phase;
+                        buffer->count.store(count + 1, std::memory_order_release);
+                } else {
+                        buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1,
+                                              std::memory_order_relaxed);
+                }
+        }
+
+        void Tracer::clear()
+        {
+                TraceRegistry& r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                for (auto& buffer : r.buffers) {
+                        buffer->count.store(0, std::memory_order_relaxed);
+                        buffer->dropped.store(0, std::memory_order_relaxed);
+                }
+        }
+
+        // The name is copied into the buffer of the thread when it
+        // records its first event, so a thread that never traces
+        // does not touch the registry.
+        void Tracer::set_thread_name(const std::string& name)
+        {
+                thread_state.name = name;
+                if (thread_state.buffer != nullptr) {
+                        std::lock_guard<std::mutex> lock(registry().mutex);
+                        thread_state.buffer->thread_name = name;
+                }
+        }
+
+        uint64_t Tracer::get_dropped_events()
+        {
+                TraceRegistry& r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                uint64_t dropped = 0;
+                for (auto& buffer : r.buffers)
+                        dropped += buffer->dropped.load(std::memory_order_relaxed);
+                return dropped;
+        }
+
+        std::string Tracer::to_json()
+        {
+                TraceRegistry& r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                int pid = (int) getpid();
+                std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+                bool first = true;
+
+                for (auto& entry : r.buffers) {
+                        char buffer[96];
+                        if (entry->thread_name.empty())
+                                continue;
+                        if (!first)
+                                out += ",";
+                        snprintf(buffer, sizeof(buffer),
+                                 "{\"name\":\"thread_name\",\"ph\":\"M\","
+                                 "\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"",
+                                 pid, entry->thread);
+                        out += buffer;
+                        append_escaped(out, entry->thread_name.c_str());
+                        out += "\"}}";
+                        first = false;
+                }
+                
+                for (auto& buffer : r.buffers) {
+                        size_t count = buffer->count.load(std::memory_order_acquire);
+                        for (size_t i = 0; i < count; i++) {
+                                if (!first)
+                                        out += ",\n";
+                                append_event(out, buffer->events[i], pid);
+                                first = false;
+                        }
+                }
+                
+                out += "]}\n";
+                return out;
+        }
+
+        bool Tracer::save(const std::string& path)
+        {
+                std::string json = to_json();
+                bool success = false;
+                FILE *fp = fopen(path.c_str(), "w");
+                if (fp != nullptr) {
+                        success = (fwrite(json.data(), 1, json.size(), fp) == json.size());
+                        success = (fclose(fp) == 0) && success;
+                }
+                return success;
+        }
+}
+
+#endif
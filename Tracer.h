@@ -0,0 +1,170 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_TRACER_H
+#define __ROMISERIAL_TRACER_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+namespace romiserial {
+
+        /**
+         *  A begin ('B'), end ('E'), or instant ('i') event, as in
+         *  the Chrome trace-event format. The name, the category,
+         *  and the argument name must be string literals.
+         */
+        struct TraceEvent
+        {
+                const char *name;
+                const char *category;
+                const char *arg_name;
+                int64_t arg;
+                // Nanoseconds on the monotonic clock.
+                uint64_t time;
+                uint32_t thread;
+                char phase;
+        };
+
+        /**
+         *  A process-wide recorder of timeline events. Each thread
+         *  appends its events to its own buffer, without locks or
+         *  read-modify-write instructions. A thread that fills its
+         *  buffer drops the next events and counts them. When
+         *  tracing is stopped, recording an event costs one relaxed
+         *  load and a branch.
+         *
+         *  The events can be exported in the JSON format of Chrome's
+         *  about:tracing and of Perfetto (ui.perfetto.dev).
+         */
+        class Tracer
+        {
+        protected:
+                friend class TraceScope;
+                
+                static std::atomic<bool> enabled_;
+
+                static void record(char phase, const char *name,
+                                   const char *category,
+                                   const char *arg_name, int64_t arg);
+
+        public:
+                static constexpr size_t kEventsPerThread = 65536;
+
+                static void start();
+                static void stop();
+                
+                static bool is_enabled() {
+                        return enabled_.load(std::memory_order_relaxed);
+                }
+
+                /** Removes all the recorded events. Should be called
+                 * while tracing is stopped. */
+                static void clear();
+
+                /** The name of the calling thread in the timeline.
+                 * It does not take a lock until the thread has
+                 * recorded events. */
+                static void set_thread_name(const std::string& name);
+
+                static void begin(const char *name, const char *category,
+                                  const char *arg_name = nullptr,
+                                  int64_t arg = 0) {
+                        if (is_enabled())
+                                record('B', name, category, arg_name, arg);
+                }
+
+                static void end(const char *name, const char *category) {
+                        if (is_enabled())
+                                record('E', name, category, nullptr, 0);
+                }
+
+                static void instant(const char *name, const char *category,
+                                    const char *arg_name = nullptr,
+                                    int64_t arg = 0) {
+                        if (is_enabled())
+                                record('i', name, category, arg_name, arg);
+                }
+
+                /** The number of events that were dropped because a
+                 * buffer was full. */
+                static uint64_t get_dropped_events();
+
+                /** The events of all the threads in the Chrome
+                 * trace-event JSON format. Can be called while
+                 * tracing. */
+                static std::string to_json();
+
+                /** Writes to_json() to a file. */
+                static bool save(const std::string& path);
+        };
+
+        /**
+         *  Records a begin event and, when it goes out of scope, the
+         *  matching end event. The end event is recorded only if the
+         *  begin event was, so that the pairs stay balanced when
+         *  tracing is started or stopped in between.
+         */
+        class TraceScope
+        {
+        protected:
+                const char *name_;
+                const char *category_;
+                bool active_;
+                
+        public:
+                TraceScope(const char *name, const char *category,
+                           const char *arg_name = nullptr, int64_t arg = 0)
+                        : name_(name), category_(category),
+                          active_(Tracer::is_enabled()) {
+                        if (active_)
+                                Tracer::begin(name, category, arg_name, arg);
+                }
+                
+                TraceScope(const TraceScope&) = delete;
+                TraceScope& operator=(const TraceScope&) = delete;
+                
+                ~TraceScope() {
+                        if (active_)
+                                Tracer::record('E', name_, category_, nullptr, 0);
+                }
+        };
+}
+
+#define ROMISERIAL_TRACE_SCOPE(...) \
+        romiserial::TraceScope romiserial_trace_scope_(__VA_ARGS__)
+#define ROMISERIAL_TRACE_INSTANT(...) \
+        romiserial::Tracer::instant(__VA_ARGS__)
+
+#else
+
+// The firmware is not traced.
+#define ROMISERIAL_TRACE_SCOPE(...)
+#define ROMISERIAL_TRACE_INSTANT(...)
+
+#endif
+#endif // __ROMISERIAL_TRACER_H
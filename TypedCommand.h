@@ -0,0 +1,135 @@
+/*
+  romi-rover
+
+  Copyright (C) 2019-2020 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  romi-rover is collection of applications for the Romi Rover.
+
+  romi-rover is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef __ROMISERIAL_TYPEDCOMMAND_H
+#define __ROMISERIAL_TYPEDCOMMAND_H
+
+#include <stdint.h>
+#include <string.h>
+#include "EnvelopeEncoder.h"
+#include "CommandTemplate.h"
+#include "MessageParser.h"
+#include "RomiSerialErrors.h"
+#include "RomiSerialUtil.h"
+
+namespace romiserial {
+
+        /*
+         *  The argument types that can be used in a typed command,
+         *  with the maximum number of characters they take in the
+         *  encoded message. Strings must be character arrays so that
+         *  their length is bounded at compile time. Other types have
+         *  no specialization and are rejected by the compiler. The
+         *  characters of a string can only be checked at run time:
+         *  encode() returns kInvalidString if the firmware would
+         *  reject one of them.
+         */
+        template <typename T> struct ArgumentTraits;
+
+        template <> struct ArgumentTraits<int16_t> {
+                static constexpr size_t max_length = 6; // -32768
+                static constexpr size_t strings = 0;
+                static int encode(EnvelopeEncoder& encoder, int16_t value) {
+                        encoder.append_int(value);
+                        return kNoError;
+                }
+        };
+
+        template <> struct ArgumentTraits<int8_t> {
+                static constexpr size_t max_length = 4; // -128
+                static constexpr size_t strings = 0;
+                static int encode(EnvelopeEncoder& encoder, int8_t value) {
+                        encoder.append_int(value);
+                        return kNoError;
+                }
+        };
+
+        template <> struct ArgumentTraits<uint8_t> {
+                static constexpr size_t max_length = 3; // 255
+                static constexpr size_t strings = 0;
+                static int encode(EnvelopeEncoder& encoder, uint8_t value) {
+                        encoder.append_int(value);
+                        return kNoError;
+                }
+        };
+
+        template <size_t N> struct ArgumentTraits<char[N]> {
+                static_assert(N - 1 <= PARSER_MAXIMUM_STRING_LENGTH,
+                              "The string argument is too long");
+                static constexpr size_t max_length = N - 1 + 2; // quotes
+                static constexpr size_t strings = 1;
+                static int encode(EnvelopeEncoder& encoder, const char *s) {
+                        size_t length = strnlen(s, N - 1);
+                        for (size_t i = 0; i < length; i++) {
+                                if (!is_valid_string_char(s[i]))
+                                        return kInvalidString;
+                        }
+                        encoder.append('"');
+                        encoder.append(s, length);
+                        encoder.append('"');
+                        return kNoError;
+                }
+        };
+
+        /**
+         *  A command whose opcode and argument types are known at
+         *  compile time. The opcode, the number of arguments, the
+         *  number of strings, and the worst-case length of the
+         *  message are checked by the compiler. Only the characters
+         *  of a string argument are checked at run time. encode()
+         *  returns zero or kInvalidString.
+         */
+        template <char Opcode, typename... Args>
+        struct TypedCommand
+        {
+                static constexpr size_t count = sizeof...(Args);
+                static constexpr size_t strings = (0 + ... + ArgumentTraits<Args>::strings);
+                static constexpr size_t max_length
+                        = 1 + ((count == 0)? 0 : 2 + (count - 1)
+                               + (0 + ... + ArgumentTraits<Args>::max_length));
+
+                static_assert(is_valid_opcode(Opcode), "Invalid opcode");
+                static_assert(count <= PARSER_MAXIMUM_ARGUMENTS, "Too many arguments");
+                static_assert(strings <= 1, "Too many strings");
+                static_assert(max_length <= MAX_MESSAGE_LENGTH,
+                              "The command may be too long");
+
+                static int encode(EnvelopeEncoder& encoder, const Args&... args) {
+                        static const CommandTemplate prefix(Opcode);
+                        int err = kNoError;
+                        prefix.start(encoder);
+                        if constexpr (count > 0) {
+                                size_t index = 0;
+                                encoder.append('[');
+                                // Stops at the first invalid argument.
+                                ((err = (err != kNoError)? err
+                                  : (index++ > 0? (void) encoder.append(',') : (void) 0,
+                                     ArgumentTraits<Args>::encode(encoder, args))), ...);
+                                encoder.append(']');
+                        }
+                        return err;
+                }
+        };
+}
+
+#endif // __ROMISERIAL_TYPEDCOMMAND_H
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <unistd.h>
 #include <RomiSerialClient.h>
+#include <RomiSerialJson.h>
 #include <RSerial.h>
 #include <Console.h>
 
@@ -1,6 +1,7 @@
 #include <memory>
 #include <unistd.h>
 #include <RomiSerialClient.h>
+#include <RomiSerialJson.h>
 #include <RSerial.h>
 #include <Console.h>
 
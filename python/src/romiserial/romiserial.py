@@ -27,9 +27,13 @@ import json
 import crc8
 import string
 
+# The firmware accepts IDs with four hex digits.
+FEATURE_LONG_ID = 2
+
 class EnvelopeEncoder():
-    def __init__(self): 
+    def __init__(self, long_ids=False): 
         self.counter = 0
+        self.long_ids = long_ids
         self.opcodes = string.ascii_lowercase + string.ascii_uppercase + string.digits + '?'
         
     def convert_string(self, s):
@@ -91,7 +95,10 @@ class EnvelopeEncoder():
     
     def _create_command_with_crc(self, s):
         self._assert_string_length(s)
-        partial_command = f'#{s}:{self.counter:02x}'
+        if self.long_ids:
+            partial_command = f'#{s}:{self.counter:04x}'
+        else:
+            partial_command = f'#{s}:{self.counter:02x}'
         crc = self._compute_crc(partial_command)
         command = f'{partial_command}{crc}\r\n'
         self._increment_counter()
@@ -103,7 +110,10 @@ class EnvelopeEncoder():
         return h.hexdigest()
 
     def _increment_counter(self):
-        self.counter = (self.counter + 1) % 255
+        if self.long_ids:
+            self.counter = (self.counter + 1) % 65536
+        else:
+            self.counter = (self.counter + 1) % 256
     
 
 class EnvelopeDecoder():
@@ -124,6 +134,11 @@ class EnvelopeDecoder():
         return (len(line) > 2
                 and line[0] == "#"
                 and line[1] == "!")
+
+    def is_pushed_message(self, line):
+        return (len(line) > 2
+                and line[0] == "#"
+                and line[1] == "*")
     
 
 class RomiDevice():
@@ -148,6 +163,17 @@ class RomiDevice():
         
     def get_debug(self):
         return self.debug
+
+    def enable_long_ids(self):
+        """Switches to IDs with four hex digits if the firmware supports
+        them. Returns True if it does."""
+        try:
+            values = self.send_command('$')
+        except RuntimeError:
+            return False
+        supported = len(values) > 2 and (values[2] & FEATURE_LONG_ID) != 0
+        self.encoder.long_ids = supported
+        return supported
         
     def execute(self, opcode, *args):
         command = self.encoder.convert(opcode, *args)
@@ -187,6 +213,8 @@ class RomiDevice():
             if self.decoder.is_valid_message(s):
                 if self.decoder.is_log_message(s):
                     self._print_log(s)
+                elif self.decoder.is_pushed_message(s):
+                    self.print_debug(f"Pushed frame: {s}")
                 else:
                     done = True
         return s
@@ -42,6 +42,13 @@ namespace romiserial {
                 return result;
         }
 
+        double rmonotonic()
+        {
+                struct timespec spec;
+                clock_gettime(CLOCK_MONOTONIC, &spec);
+                return (double) spec.tv_sec + (double) spec.tv_nsec / 1.0e9;
+        }
+
         void rsleep(double seconds)
         {
                 struct timespec spec;
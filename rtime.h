@@ -29,6 +29,10 @@ namespace romiserial {
 
         void rsleep(double duration);
         double rtime();
+
+        // The time of the monotonic clock, in seconds. Unlike
+        // rtime(), it does not jump when the system time is set.
+        double rmonotonic();
 }
 
 #endif // __ROMISERIAL_RSLEEP_H